@@ -0,0 +1,885 @@
+#include "Batch.hpp"
+#include "Random.hpp"
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+
+//where the font is, the same as in Chip8.cpp
+const unsigned int BATCH_FONT_START_ADDRESS = 0x50;
+
+/***************************************************
+*  Lane vectors                                    *
+*                                                  *
+*  Bytes is BATCH_VECTOR_BYTES lanes of one 8 bit  *
+*  register. the kernels only use the handful of   *
+*  operations below, so a new instruction set is   *
+*  just another version of them.                   *
+***************************************************/
+
+#if defined(__AVX2__)
+
+struct Bytes
+{
+	__m256i v;
+
+	static Bytes Load(uint8_t const* p) { return { _mm256_loadu_si256((__m256i const*)p) }; }
+	static Bytes Splat(uint8_t b) { return { _mm256_set1_epi8((char)b) }; }
+	void Store(uint8_t* p) const { _mm256_storeu_si256((__m256i*)p, v); }
+};
+
+inline Bytes operator+(Bytes a, Bytes b) { return { _mm256_add_epi8(a.v, b.v) }; }
+inline Bytes operator-(Bytes a, Bytes b) { return { _mm256_sub_epi8(a.v, b.v) }; }
+inline Bytes operator&(Bytes a, Bytes b) { return { _mm256_and_si256(a.v, b.v) }; }
+inline Bytes operator|(Bytes a, Bytes b) { return { _mm256_or_si256(a.v, b.v) }; }
+inline Bytes operator^(Bytes a, Bytes b) { return { _mm256_xor_si256(a.v, b.v) }; }
+inline Bytes AndNot(Bytes a, Bytes b) { return { _mm256_andnot_si256(a.v, b.v) }; }	//~a & b
+inline Bytes Equal(Bytes a, Bytes b) { return { _mm256_cmpeq_epi8(a.v, b.v) }; }
+inline Bytes Min(Bytes a, Bytes b) { return { _mm256_min_epu8(a.v, b.v) }; }
+inline Bytes SubSaturate(Bytes a, Bytes b) { return { _mm256_subs_epu8(a.v, b.v) }; }
+//there is no 8 bit shift, shift 16 bit lanes and drop what came over from the neighbour
+inline Bytes ShiftRight1(Bytes a) { return { _mm256_and_si256(_mm256_srli_epi16(a.v, 1), _mm256_set1_epi8(0x7F)) }; }
+//the top bit of every lane
+inline uint32_t MoveMask(Bytes a) { return (uint32_t)_mm256_movemask_epi8(a.v); }
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+struct Bytes
+{
+	__m128i v;
+
+	static Bytes Load(uint8_t const* p) { return { _mm_loadu_si128((__m128i const*)p) }; }
+	static Bytes Splat(uint8_t b) { return { _mm_set1_epi8((char)b) }; }
+	void Store(uint8_t* p) const { _mm_storeu_si128((__m128i*)p, v); }
+};
+
+inline Bytes operator+(Bytes a, Bytes b) { return { _mm_add_epi8(a.v, b.v) }; }
+inline Bytes operator-(Bytes a, Bytes b) { return { _mm_sub_epi8(a.v, b.v) }; }
+inline Bytes operator&(Bytes a, Bytes b) { return { _mm_and_si128(a.v, b.v) }; }
+inline Bytes operator|(Bytes a, Bytes b) { return { _mm_or_si128(a.v, b.v) }; }
+inline Bytes operator^(Bytes a, Bytes b) { return { _mm_xor_si128(a.v, b.v) }; }
+inline Bytes AndNot(Bytes a, Bytes b) { return { _mm_andnot_si128(a.v, b.v) }; }	//~a & b
+inline Bytes Equal(Bytes a, Bytes b) { return { _mm_cmpeq_epi8(a.v, b.v) }; }
+inline Bytes Min(Bytes a, Bytes b) { return { _mm_min_epu8(a.v, b.v) }; }
+inline Bytes SubSaturate(Bytes a, Bytes b) { return { _mm_subs_epu8(a.v, b.v) }; }
+inline Bytes ShiftRight1(Bytes a) { return { _mm_and_si128(_mm_srli_epi16(a.v, 1), _mm_set1_epi8(0x7F)) }; }
+inline uint32_t MoveMask(Bytes a) { return (uint32_t)_mm_movemask_epi8(a.v); }
+
+#else
+
+//no vector instructions we know of, one byte at a time (the compiler
+//may still turn these loops into vector code)
+struct Bytes
+{
+	uint8_t b[BATCH_VECTOR_BYTES];
+
+	static Bytes Load(uint8_t const* p) { Bytes r; memcpy(r.b, p, sizeof(r.b)); return r; }
+	static Bytes Splat(uint8_t value) { Bytes r; memset(r.b, value, sizeof(r.b)); return r; }
+	void Store(uint8_t* p) const { memcpy(p, b, sizeof(b)); }
+};
+
+template <typename Op>
+inline Bytes Lanewise(Bytes a, Bytes b, Op op)
+{
+	Bytes r;
+	for (unsigned int i = 0; i < BATCH_VECTOR_BYTES; ++i)
+	{
+		r.b[i] = (uint8_t)op(a.b[i], b.b[i]);
+	}
+	return r;
+}
+
+inline Bytes operator+(Bytes a, Bytes b) { return Lanewise(a, b, [](uint8_t x, uint8_t y) { return x + y; }); }
+inline Bytes operator-(Bytes a, Bytes b) { return Lanewise(a, b, [](uint8_t x, uint8_t y) { return x - y; }); }
+inline Bytes operator&(Bytes a, Bytes b) { return Lanewise(a, b, [](uint8_t x, uint8_t y) { return x & y; }); }
+inline Bytes operator|(Bytes a, Bytes b) { return Lanewise(a, b, [](uint8_t x, uint8_t y) { return x | y; }); }
+inline Bytes operator^(Bytes a, Bytes b) { return Lanewise(a, b, [](uint8_t x, uint8_t y) { return x ^ y; }); }
+inline Bytes AndNot(Bytes a, Bytes b) { return Lanewise(a, b, [](uint8_t x, uint8_t y) { return ~x & y; }); }
+inline Bytes Equal(Bytes a, Bytes b) { return Lanewise(a, b, [](uint8_t x, uint8_t y) { return x == y ? 0xFF : 0; }); }
+inline Bytes Min(Bytes a, Bytes b) { return Lanewise(a, b, [](uint8_t x, uint8_t y) { return x < y ? x : y; }); }
+inline Bytes SubSaturate(Bytes a, Bytes b) { return Lanewise(a, b, [](uint8_t x, uint8_t y) { return x > y ? x - y : 0; }); }
+inline Bytes ShiftRight1(Bytes a) { return Lanewise(a, a, [](uint8_t x, uint8_t) { return x >> 1u; }); }
+inline uint32_t MoveMask(Bytes a)
+{
+	uint32_t bits = 0;
+	for (unsigned int i = 0; i < BATCH_VECTOR_BYTES; ++i)
+	{
+		bits |= (uint32_t)(a.b[i] >> 7u) << i;
+	}
+	return bits;
+}
+
+#endif
+
+//0xFF where a > b (unsigned), 0 elsewhere
+inline Bytes Greater(Bytes a, Bytes b)
+{
+	return Equal(Min(a, b), a) ^ Bytes::Splat(0xFF);
+}
+
+//a where the mask is 0xFF, b elsewhere
+inline Bytes Blend(Bytes mask, Bytes a, Bytes b)
+{
+	return (mask & a) | AndNot(mask, b);
+}
+
+//for every set bit of lanes, lowest first
+template <typename Function>
+inline void ForEachLane(uint32_t lanes, Function function)
+{
+	while (lanes != 0)
+	{
+#if defined(__GNUC__)
+		unsigned int lane = (unsigned int)__builtin_ctz(lanes);
+#else
+		unsigned int lane = 0;
+		while (((lanes >> lane) & 1u) == 0)
+		{
+			++lane;
+		}
+#endif
+
+		function(lane);
+		lanes &= lanes - 1;
+	}
+}
+
+template <unsigned int LANES>
+Chip8Batch<LANES>::Chip8Batch(uint64_t seed, uint64_t firstStream) : memory(new uint8_t[LANES * MEMORY_SIZE]())
+{
+	for (unsigned int lane = 0; lane < LANES; ++lane)
+	{
+		allMask[lane] = 0xFF;
+	}
+
+	//a fresh Chip8 per lane, so the font, pc and random streams are set up
+	//exactly like they are for a single machine
+	Chip8State state;
+	for (unsigned int lane = 0; lane < LANES; ++lane)
+	{
+		Chip8 chip8(seed, firstStream + lane);
+		chip8.SaveState(state);
+		LoadState(lane, state);
+	}
+}
+
+template <unsigned int LANES>
+bool Chip8Batch<LANES>::LoadROM(char const* filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	return LoadROM(rom.data(), rom.size());
+}
+
+template <unsigned int LANES>
+bool Chip8Batch<LANES>::LoadROM(uint8_t const* data, size_t size)
+{
+	if (size > MEMORY_SIZE - START_ADDRESS)
+	{
+		return false;
+	}
+
+	for (unsigned int lane = 0; lane < LANES; ++lane)
+	{
+		memcpy(&memory[lane * MEMORY_SIZE + START_ADDRESS], data, size);
+	}
+	CompareMemory();
+
+	return true;
+}
+
+template <unsigned int LANES>
+void Chip8Batch<LANES>::TickTimers()
+{
+	Bytes one = Bytes::Splat(1);
+
+	for (unsigned int c = 0; c < ROW; c += BATCH_VECTOR_BYTES)
+	{
+		SubSaturate(Bytes::Load(delay + c), one).Store(delay + c);
+		SubSaturate(Bytes::Load(sound + c), one).Store(sound + c);
+	}
+}
+
+template <unsigned int LANES>
+void Chip8Batch<LANES>::SetKeypad(unsigned int lane, uint16_t keys)
+{
+	for (unsigned int key = 0; key < KEY_COUNT; ++key)
+	{
+		keypad[key][lane] = (keys >> key) & 1u;
+	}
+}
+
+template <unsigned int LANES>
+void Chip8Batch<LANES>::GetVideo(unsigned int lane, uint64_t* rows) const
+{
+	for (unsigned int row = 0; row < VIDEO_HEIGHT; ++row)
+	{
+		rows[row] = video[row][lane];
+	}
+}
+
+template <unsigned int LANES>
+void Chip8Batch<LANES>::SaveState(unsigned int lane, Chip8State& state) const
+{
+	memcpy(state.memory, &memory[lane * MEMORY_SIZE], MEMORY_SIZE);
+	for (unsigned int i = 0; i < REGISTER_COUNT; ++i)
+	{
+		state.registers[i] = registers[i][lane];
+	}
+	state.index = index[lane];
+	state.pc = pc[lane];
+	for (unsigned int i = 0; i < STACK_LEVELS; ++i)
+	{
+		state.stack[i] = stack[i][lane];
+	}
+	state.sp = sp[lane];
+	state.delay = delay[lane];
+	state.sound = sound[lane];
+	for (unsigned int i = 0; i < KEY_COUNT; ++i)
+	{
+		state.keypad[i] = keypad[i][lane];
+	}
+	GetVideo(lane, state.video);
+	state.randomKey = randomKey[lane];
+	state.randomCounter = randomCounter[lane];
+}
+
+template <unsigned int LANES>
+void Chip8Batch<LANES>::LoadState(unsigned int lane, Chip8State const& state)
+{
+	memcpy(&memory[lane * MEMORY_SIZE], state.memory, MEMORY_SIZE);
+	for (unsigned int i = 0; i < REGISTER_COUNT; ++i)
+	{
+		registers[i][lane] = state.registers[i];
+	}
+	index[lane] = state.index;
+	pc[lane] = state.pc;
+	for (unsigned int i = 0; i < STACK_LEVELS; ++i)
+	{
+		stack[i][lane] = state.stack[i];
+	}
+	sp[lane] = state.sp;
+	delay[lane] = state.delay;
+	sound[lane] = state.sound;
+	for (unsigned int i = 0; i < KEY_COUNT; ++i)
+	{
+		keypad[i][lane] = state.keypad[i];
+	}
+	for (unsigned int row = 0; row < VIDEO_HEIGHT; ++row)
+	{
+		video[row][lane] = state.video[row];
+	}
+	randomKey[lane] = state.randomKey;
+	randomCounter[lane] = state.randomCounter;
+
+	CompareMemory();
+}
+
+//find the blocks where any lane is different from lane 0
+template <unsigned int LANES>
+void Chip8Batch<LANES>::CompareMemory()
+{
+	differentBlocks = 0;
+
+	for (unsigned int block = 0; block < 64; ++block)
+	{
+		for (unsigned int lane = 1; lane < LANES; ++lane)
+		{
+			if (memcmp(&memory[block * BLOCK_SIZE], &memory[lane * MEMORY_SIZE + block * BLOCK_SIZE], BLOCK_SIZE) != 0)
+			{
+				differentBlocks |= (uint64_t)1 << block;
+				break;
+			}
+		}
+	}
+}
+
+//the lanes of group wrote length bytes at their I. unless every lane wrote the
+//same bytes to the same place, the blocks they wrote to can now be different
+template <unsigned int LANES>
+void Chip8Batch<LANES>::WroteMemory(uint32_t group, unsigned int length)
+{
+	bool same = group == ALL_LANES;
+	for (unsigned int lane = 1; lane < LANES && same; ++lane)
+	{
+		same = index[lane] == index[0];
+	}
+
+	for (unsigned int i = 0; i < length && same; ++i)
+	{
+		unsigned int address = (index[0] + i) & (MEMORY_SIZE - 1);
+		for (unsigned int lane = 1; lane < LANES && same; ++lane)
+		{
+			same = memory[lane * MEMORY_SIZE + address] == memory[address];
+		}
+	}
+
+	if (same)
+	{
+		return;
+	}
+
+	ForEachLane(group, [&](unsigned int lane)
+	{
+		for (unsigned int i = 0; i < length; ++i)
+		{
+			differentBlocks |= (uint64_t)1 << (((index[lane] + i) & (MEMORY_SIZE - 1)) / BLOCK_SIZE);
+		}
+	});
+}
+
+template <unsigned int LANES>
+uint16_t Chip8Batch<LANES>::Fetch(unsigned int lane, uint16_t address) const
+{
+	uint8_t const* laneMemory = &memory[lane * MEMORY_SIZE];
+	return (laneMemory[address & (MEMORY_SIZE - 1)] << 8u) | laneMemory[(address + 1) & (MEMORY_SIZE - 1)];
+}
+
+//true if every lane has the same instruction at address
+template <unsigned int LANES>
+bool Chip8Batch<LANES>::SameOpcode(uint16_t address) const
+{
+	uint64_t blocks = ((uint64_t)1 << ((address & (MEMORY_SIZE - 1)) / BLOCK_SIZE))
+		| ((uint64_t)1 << (((address + 1) & (MEMORY_SIZE - 1)) / BLOCK_SIZE));
+	if ((differentBlocks & blocks) == 0)
+	{
+		return true;
+	}
+
+	uint16_t opcode = Fetch(0, address);
+	for (unsigned int lane = 1; lane < LANES; ++lane)
+	{
+		if (Fetch(lane, address) != opcode)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+//bit n set for the lanes whose pc is address
+template <unsigned int LANES>
+uint32_t Chip8Batch<LANES>::LanesAt(uint16_t address) const
+{
+	uint32_t lanes = 0;
+	for (unsigned int lane = 0; lane < LANES; ++lane)
+	{
+		lanes |= (uint32_t)(pc[lane] == address) << lane;
+	}
+	return lanes;
+}
+
+template <unsigned int LANES>
+void Chip8Batch<LANES>::SetMask(uint32_t group, uint8_t* mask) const
+{
+	for (unsigned int lane = 0; lane < ROW; ++lane)
+	{
+		mask[lane] = lane < LANES && ((group >> lane) & 1u) ? 0xFF : 0;
+	}
+}
+
+template <unsigned int LANES>
+uint64_t Chip8Batch<LANES>::Run(uint64_t cycles)
+{
+	uint64_t remaining[LANES];
+	for (unsigned int lane = 0; lane < LANES; ++lane)
+	{
+		remaining[lane] = cycles;
+	}
+
+	while (true)
+	{
+		uint32_t active = 0;
+		uint64_t fewest = ~(uint64_t)0;
+		uint64_t most = 0;
+		unsigned int leader = 0;
+		bool samePc = true;
+
+		for (unsigned int lane = 0; lane < LANES; ++lane)
+		{
+			if (remaining[lane] > 0)
+			{
+				active |= 1u << lane;
+				fewest = remaining[lane] < fewest ? remaining[lane] : fewest;
+				if (remaining[lane] > most)
+				{
+					most = remaining[lane];
+					leader = lane;
+				}
+			}
+			samePc = samePc && pc[lane] == pc[0];
+		}
+
+		if (active == 0)
+		{
+			break;
+		}
+
+		if (active == ALL_LANES && samePc && SameOpcode(pc[0]))
+		{
+			uint64_t steps = RunLockstep(fewest);
+			for (unsigned int lane = 0; lane < LANES; ++lane)
+			{
+				remaining[lane] -= steps;
+			}
+			continue;
+		}
+
+		//the lanes that are where the lane furthest behind is run together until
+		//they split up, one of them is done, or they get to where other lanes wait
+		uint16_t address = pc[leader];
+		uint16_t opcode = Fetch(leader, address);
+		bool checkOpcode = !SameOpcode(address);
+		uint32_t group = 0;
+		uint64_t groupFewest = ~(uint64_t)0;
+
+		ForEachLane(active, [&](unsigned int lane)
+		{
+			if (pc[lane] == address && (!checkOpcode || Fetch(lane, address) == opcode))
+			{
+				group |= 1u << lane;
+				groupFewest = remaining[lane] < groupFewest ? remaining[lane] : groupFewest;
+			}
+		});
+
+		SetMask(group, groupMask);
+		uint32_t others = active & ~group;
+		uint64_t steps = 0;
+		bool together = true;
+
+		while (steps < groupFewest)
+		{
+			uint16_t next;
+			together = Execute<false>(address, opcode, group, groupMask, next);
+			++steps;
+
+			if (!together)
+			{
+				break;
+			}
+
+			address = next;
+			//FX33/FX55 of the group can make the code of the lanes different from
+			//here on, so this is checked after every step (free while no block differs)
+			if ((LanesAt(address) & others) != 0 || !SameOpcode(address))
+			{
+				break;
+			}
+			opcode = Fetch(leader, address);
+		}
+
+		if (together)
+		{
+			ForEachLane(group, [&](unsigned int lane)
+			{
+				pc[lane] = address;
+			});
+		}
+
+		ForEachLane(group, [&](unsigned int lane)
+		{
+			remaining[lane] -= steps;
+			divergedInstructions += steps;
+		});
+	}
+
+	return cycles;
+}
+
+//every lane is at the same pc with the same instruction there.
+//runs until steps instructions are done or the lanes go different ways.
+//the shared pc is kept in address and only written to the lanes at the end
+template <unsigned int LANES>
+uint64_t Chip8Batch<LANES>::RunLockstep(uint64_t steps)
+{
+	uint64_t step = 0;
+	uint16_t address = pc[0];
+
+	while (step < steps)
+	{
+		uint16_t next;
+		bool together = Execute<true>(address, Fetch(0, address), ALL_LANES, allMask, next);
+		++step;
+
+		if (!together)
+		{
+			//every lane got its own pc, maybe they still agree
+			bool samePc = true;
+			for (unsigned int lane = 1; lane < LANES; ++lane)
+			{
+				samePc = samePc && pc[lane] == pc[0];
+			}
+
+			if (!samePc)
+			{
+				lockstepInstructions += step * LANES;
+				return step;
+			}
+			next = pc[0];
+		}
+
+		address = next;
+		if (differentBlocks != 0 && !SameOpcode(address))
+		{
+			break;
+		}
+	}
+
+	for (unsigned int lane = 0; lane < ROW; ++lane)
+	{
+		pc[lane] = address;
+	}
+
+	lockstepInstructions += step * LANES;
+	return step;
+}
+
+//store value into the lanes of mask. with ALL every lane is in the group,
+//so there is nothing to keep
+template <bool ALL>
+inline void Put(uint8_t* row, Bytes value, uint8_t const* mask)
+{
+	if (ALL)
+	{
+		value.Store(row);
+	}
+	else
+	{
+		Blend(Bytes::Load(mask), value, Bytes::Load(row)).Store(row);
+	}
+}
+
+/*
+Run one instruction on a group of lanes. this is OP_* from Chip8.cpp, one lane
+vector at a time where the lanes can be done together, one lane at a time where
+each lane needs something of its own (memory, stack, random numbers, the screen)
+
+Parameters:
+ALL = group is every lane
+address = where the instruction is, every lane of the group is there
+opcode = the instruction
+group = bit n set for lane n
+mask = 0xFF for the lanes of group, 0 for the others
+next = where the lanes go next, when they all go to the same place
+
+Returns:
+true if every lane of the group goes to next. false if the instruction
+already wrote the pc of each lane of the group itself
+*/
+template <unsigned int LANES>
+template <bool ALL>
+bool Chip8Batch<LANES>::Execute(uint16_t address, uint16_t opcode, uint32_t group, uint8_t const* mask, uint16_t& next)
+{
+	unsigned int x = (opcode & 0x0F00u) >> 8u;
+	unsigned int y = (opcode & 0x00F0u) >> 4u;
+	uint8_t kk = opcode & 0x00FFu;
+	uint16_t nnn = opcode & 0x0FFFu;
+
+	next = address + 2;
+
+	//bit n set for the lanes that skip the next instruction
+	uint32_t skipped = 0;
+	bool skip = false;
+
+	switch (opcode >> 12u)
+	{
+		case 0x0:
+			if ((opcode & 0x000Fu) == 0x0)
+			{
+				ForEachLane(group, [&](unsigned int lane)
+				{
+					for (unsigned int row = 0; row < VIDEO_HEIGHT; ++row)
+					{
+						video[row][lane] = 0;
+					}
+				});
+			}
+			else if ((opcode & 0x000Fu) == 0xE)
+			{
+				ForEachLane(group, [&](unsigned int lane)
+				{
+					--sp[lane];
+					pc[lane] = stack[sp[lane] & (STACK_LEVELS - 1)][lane];
+				});
+				return false;
+			}
+			break;
+
+		case 0x1:
+			next = nnn;
+			break;
+
+		case 0x2:
+			ForEachLane(group, [&](unsigned int lane)
+			{
+				stack[sp[lane] & (STACK_LEVELS - 1)][lane] = address + 2;
+				++sp[lane];
+			});
+			next = nnn;
+			break;
+
+		case 0x3:
+		case 0x4:
+		case 0x5:
+		case 0x9:
+		{
+			bool withByte = (opcode >> 12u) == 0x3 || (opcode >> 12u) == 0x4;
+			bool notEqual = (opcode >> 12u) == 0x4 || (opcode >> 12u) == 0x9;
+
+			for (unsigned int c = 0; c < ROW; c += BATCH_VECTOR_BYTES)
+			{
+				Bytes other = withByte ? Bytes::Splat(kk) : Bytes::Load(registers[y] + c);
+				Bytes equal = Equal(Bytes::Load(registers[x] + c), other);
+				skipped |= MoveMask(notEqual ? equal ^ Bytes::Splat(0xFF) : equal) << c;
+			}
+			skip = true;
+			break;
+		}
+
+		case 0x6:
+			for (unsigned int c = 0; c < ROW; c += BATCH_VECTOR_BYTES)
+			{
+				Put<ALL>(registers[x] + c, Bytes::Splat(kk), mask + c);
+			}
+			break;
+
+		case 0x7:
+			for (unsigned int c = 0; c < ROW; c += BATCH_VECTOR_BYTES)
+			{
+				Put<ALL>(registers[x] + c, Bytes::Load(registers[x] + c) + Bytes::Splat(kk), mask + c);
+			}
+			break;
+
+		case 0x8:
+			//VF is written before Vx, and Vx is read again after that,
+			//so x or y being F comes out the same as in the OP_8XY* handlers
+			for (unsigned int c = 0; c < ROW; c += BATCH_VECTOR_BYTES)
+			{
+				Bytes one = Bytes::Splat(1);
+				uint8_t const* m = mask + c;
+				uint8_t* vx = registers[x] + c;
+				uint8_t* vy = registers[y] + c;
+				uint8_t* vf = registers[0xF] + c;
+
+				switch (opcode & 0x000Fu)
+				{
+					case 0x0:
+						Put<ALL>(vx, Bytes::Load(vy), m);
+						break;
+					case 0x1:
+						Put<ALL>(vx, Bytes::Load(vx) | Bytes::Load(vy), m);
+						break;
+					case 0x2:
+						Put<ALL>(vx, Bytes::Load(vx) & Bytes::Load(vy), m);
+						break;
+					case 0x3:
+						Put<ALL>(vx, Bytes::Load(vx) ^ Bytes::Load(vy), m);
+						break;
+					case 0x4:
+					{
+						Bytes sum = Bytes::Load(vx) + Bytes::Load(vy);
+						//the sum wrapped around if it is smaller than Vx
+						Put<ALL>(vf, Greater(Bytes::Load(vx), sum) & one, m);
+						Put<ALL>(vx, sum, m);
+						break;
+					}
+					case 0x5:
+						Put<ALL>(vf, Greater(Bytes::Load(vx), Bytes::Load(vy)) & one, m);
+						Put<ALL>(vx, Bytes::Load(vx) - Bytes::Load(vy), m);
+						break;
+					case 0x6:
+						Put<ALL>(vf, Bytes::Load(vx) & one, m);
+						Put<ALL>(vx, ShiftRight1(Bytes::Load(vx)), m);
+						break;
+					case 0x7:
+						Put<ALL>(vf, Greater(Bytes::Load(vy), Bytes::Load(vx)) & one, m);
+						Put<ALL>(vx, Bytes::Load(vy) - Bytes::Load(vx), m);
+						break;
+					case 0xE:
+						Put<ALL>(vf, Greater(Bytes::Load(vx), Bytes::Splat(0x7F)) & one, m);
+						Put<ALL>(vx, Bytes::Load(vx) + Bytes::Load(vx), m);
+						break;
+				}
+			}
+			break;
+
+		case 0xA:
+			for (unsigned int lane = 0; lane < ROW; ++lane)
+			{
+				index[lane] = ALL || mask[lane] ? nnn : index[lane];
+			}
+			break;
+
+		case 0xB:
+			ForEachLane(group, [&](unsigned int lane)
+			{
+				pc[lane] = registers[0][lane] + nnn;
+			});
+			return false;
+
+		case 0xC:
+			ForEachLane(group, [&](unsigned int lane)
+			{
+				registers[x][lane] = (uint8_t)(Chip8Random::Next(randomKey[lane], randomCounter[lane]++) & kk);
+			});
+			break;
+
+		case 0xD:
+			ForEachLane(group, [&](unsigned int lane)
+			{
+				uint8_t const* laneMemory = &memory[lane * MEMORY_SIZE];
+				unsigned int height = opcode & 0x000Fu;
+
+				//VF is cleared before the position is read, like OP_DXYN does
+				registers[0xF][lane] = 0;
+				unsigned int xPos = registers[x][lane] % VIDEO_WIDTH;
+				unsigned int yPos = registers[y][lane] % VIDEO_HEIGHT;
+				uint8_t collision = 0;
+
+				for (unsigned int row = 0; row < height && yPos + row < VIDEO_HEIGHT; ++row)
+				{
+					uint64_t spriteRow = ((uint64_t)laneMemory[(index[lane] + row) & (MEMORY_SIZE - 1)] << 56u) >> xPos;
+					uint64_t& screenRow = video[yPos + row][lane];
+
+					collision |= (screenRow & spriteRow) != 0;
+					screenRow ^= spriteRow;
+				}
+
+				registers[0xF][lane] |= collision;
+			});
+			break;
+
+		case 0xE:
+			if ((opcode & 0x000Fu) == 0xE || (opcode & 0x000Fu) == 0x1)
+			{
+				bool pressed = (opcode & 0x000Fu) == 0xE;
+				for (unsigned int lane = 0; lane < LANES; ++lane)
+				{
+					bool down = keypad[registers[x][lane] & (KEY_COUNT - 1)][lane] != 0;
+					skipped |= (uint32_t)(down == pressed) << lane;
+				}
+				skip = true;
+			}
+			break;
+
+		case 0xF:
+			switch (opcode & 0x00FFu)
+			{
+				case 0x07:
+					for (unsigned int c = 0; c < ROW; c += BATCH_VECTOR_BYTES)
+					{
+						Put<ALL>(registers[x] + c, Bytes::Load(delay + c), mask + c);
+					}
+					break;
+				case 0x0A:
+					//lanes without a key pressed stay on this instruction
+					ForEachLane(group, [&](unsigned int lane)
+					{
+						pc[lane] = address;
+						for (unsigned int key = 0; key < KEY_COUNT; ++key)
+						{
+							if (keypad[key][lane])
+							{
+								registers[x][lane] = key;
+								pc[lane] = address + 2;
+								break;
+							}
+						}
+					});
+					return false;
+				case 0x15:
+					for (unsigned int c = 0; c < ROW; c += BATCH_VECTOR_BYTES)
+					{
+						Put<ALL>(delay + c, Bytes::Load(registers[x] + c), mask + c);
+					}
+					break;
+				case 0x18:
+					for (unsigned int c = 0; c < ROW; c += BATCH_VECTOR_BYTES)
+					{
+						Put<ALL>(sound + c, Bytes::Load(registers[x] + c), mask + c);
+					}
+					break;
+				case 0x1E:
+					for (unsigned int lane = 0; lane < ROW; ++lane)
+					{
+						index[lane] += ALL || mask[lane] ? registers[x][lane] : 0;
+					}
+					break;
+				case 0x29:
+					for (unsigned int lane = 0; lane < ROW; ++lane)
+					{
+						index[lane] = ALL || mask[lane] ? BATCH_FONT_START_ADDRESS + 5 * registers[x][lane] : index[lane];
+					}
+					break;
+				case 0x33:
+					ForEachLane(group, [&](unsigned int lane)
+					{
+						uint8_t* laneMemory = &memory[lane * MEMORY_SIZE];
+						uint8_t value = registers[x][lane];
+
+						laneMemory[(index[lane] + 2) & (MEMORY_SIZE - 1)] = value % 10;
+						value /= 10;
+						laneMemory[(index[lane] + 1) & (MEMORY_SIZE - 1)] = value % 10;
+						value /= 10;
+						laneMemory[index[lane] & (MEMORY_SIZE - 1)] = value % 10;
+					});
+					WroteMemory(group, 3);
+					break;
+				case 0x55:
+					ForEachLane(group, [&](unsigned int lane)
+					{
+						uint8_t* laneMemory = &memory[lane * MEMORY_SIZE];
+						for (unsigned int i = 0; i <= x; ++i)
+						{
+							laneMemory[(index[lane] + i) & (MEMORY_SIZE - 1)] = registers[i][lane];
+						}
+					});
+					WroteMemory(group, x + 1);
+					break;
+				case 0x65:
+					ForEachLane(group, [&](unsigned int lane)
+					{
+						uint8_t const* laneMemory = &memory[lane * MEMORY_SIZE];
+						for (unsigned int i = 0; i <= x; ++i)
+						{
+							registers[i][lane] = laneMemory[(index[lane] + i) & (MEMORY_SIZE - 1)];
+						}
+					});
+					break;
+			}
+			break;
+	}
+
+	if (skip)
+	{
+		skipped &= group;
+		if (skipped == group)
+		{
+			next = address + 4;
+		}
+		else if (skipped != 0)
+		{
+			ForEachLane(group, [&](unsigned int lane)
+			{
+				pc[lane] = address + ((skipped >> lane) & 1u ? 4 : 2);
+			});
+			return false;
+		}
+	}
+
+	return true;
+}
+
+template class Chip8Batch<8>;
+template class Chip8Batch<16>;
+template class Chip8Batch<32>;
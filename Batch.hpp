@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "Chip8.hpp"
+
+//the batch kernels work on one vector of lanes at a time: 32 bytes with AVX2,
+//16 with SSE2 (every x86-64 CPU) or a plain byte loop anywhere else
+#if defined(__AVX2__)
+const unsigned int BATCH_VECTOR_BYTES = 32;
+#else
+const unsigned int BATCH_VECTOR_BYTES = 16;
+#endif
+
+//a batch of LANES machines running the same ROM, for running lots of copies
+//that only differ in their keys and random seed.
+//the state is kept lane by lane (structure of arrays): registers[x] is the Vx
+//of every lane next to each other, the same for I, pc, sp, the timers, the
+//stack and the screen. memory is one 4 KB block per lane.
+//
+//while all the lanes are at the same pc (lockstep) an instruction is fetched
+//and decoded once and the ALU, skip and load instructions run on every lane at
+//once with vector instructions. when the lanes split up (a skip that some lanes
+//take and others dont, different return addresses, ...) the batch runs one
+//group of lanes that share a pc at a time, starting with the lane that is
+//furthest behind, and stops the group where other lanes are waiting, so lanes
+//that go the same way again end up back in lockstep.
+//
+//every lane runs exactly like a Chip8 with the same seed and keys would
+//(Dispatch::Table), except where a single Chip8 would read or write outside of
+//its arrays: addresses past the end of memory and key numbers past F wrap around,
+//and the stack has exactly STACK_LEVELS entries
+template <unsigned int LANES>
+class Chip8Batch
+{
+	static_assert(LANES == 8 || LANES == 16 || LANES == 32, "a batch has 8, 16 or 32 lanes");
+
+public:
+	//lane i gets the random numbers of Chip8(seed, firstStream + i)
+	explicit Chip8Batch(uint64_t seed, uint64_t firstStream = 0);
+
+	//the same ROM in every lane, the machines start over
+	bool LoadROM(char const* filename);
+	bool LoadROM(uint8_t const* data, size_t size);
+
+	//run cycles instructions on every lane. returns cycles
+	uint64_t Run(uint64_t cycles);
+	void TickTimers();
+
+	//bit k of keys = key k is held, the same as KeypadMask in Movie.hpp
+	void SetKeypad(unsigned int lane, uint16_t keys);
+
+	//one row per uint64_t, the same as Chip8::video
+	void GetVideo(unsigned int lane, uint64_t* rows) const;
+
+	//move single machines in and out of the batch
+	void SaveState(unsigned int lane, Chip8State& state) const;
+	void LoadState(unsigned int lane, Chip8State const& state);
+
+	//lane instructions that ran in lockstep and one group at a time
+	uint64_t LockstepInstructions() const { return lockstepInstructions; }
+	uint64_t DivergedInstructions() const { return divergedInstructions; }
+
+private:
+	//rows are padded up to a whole vector, the lanes past LANES are never used
+	static const unsigned int ROW = LANES > BATCH_VECTOR_BYTES ? LANES : BATCH_VECTOR_BYTES;
+	static const uint32_t ALL_LANES = LANES == 32 ? 0xFFFFFFFFu : (1u << LANES) - 1;
+	//memory is compared between lanes in blocks of this many bytes
+	static const unsigned int BLOCK_SIZE = MEMORY_SIZE / 64;
+
+	uint64_t RunLockstep(uint64_t steps);
+	template <bool ALL>
+	bool Execute(uint16_t address, uint16_t opcode, uint32_t group, uint8_t const* mask, uint16_t& next);
+	uint16_t Fetch(unsigned int lane, uint16_t address) const;
+	bool SameOpcode(uint16_t address) const;
+	uint32_t LanesAt(uint16_t address) const;
+	void SetMask(uint32_t group, uint8_t* mask) const;
+	void WroteMemory(uint32_t group, unsigned int length);
+	void CompareMemory();
+
+	alignas(32) uint8_t registers[REGISTER_COUNT][ROW]{};
+	alignas(32) uint8_t delay[ROW]{};
+	alignas(32) uint8_t sound[ROW]{};
+	alignas(32) uint8_t sp[ROW]{};
+	alignas(32) uint8_t keypad[KEY_COUNT][ROW]{};
+	alignas(32) uint16_t index[ROW]{};
+	alignas(32) uint16_t pc[ROW]{};
+	alignas(32) uint16_t stack[STACK_LEVELS][ROW]{};
+	alignas(32) uint8_t allMask[ROW]{};	//0xFF for every lane
+	alignas(32) uint8_t groupMask[ROW]{};	//0xFF for the lanes of the group that runs
+	uint64_t video[VIDEO_HEIGHT][LANES]{};
+	uint64_t randomKey[LANES]{};
+	uint64_t randomCounter[LANES]{};
+
+	//LANES * MEMORY_SIZE bytes, lane after lane
+	std::unique_ptr<uint8_t[]> memory;
+	//bit b set = the lanes may have different bytes in block b of memory.
+	//while it is 0 every lane has the same program, and fetching from lane 0 is enough
+	uint64_t differentBlocks{};
+
+	uint64_t lockstepInstructions{};
+	uint64_t divergedInstructions{};
+};
@@ -12,15 +12,19 @@
 
 
 #include "Chip8.hpp"
+#include "Jit.hpp"
 #include "fstream" //for input and output streams
-#include "random" //obviously for random number stuff
+#include "Random.hpp"
+#include "StateHash.hpp"
 #include "chrono" //for clock stuff (date / time)
+#include "cstring" //for memset
+#include "mutex" //for the table of shared ROMs
+#include "unordered_map"
 
 //bitwise operators for reference:
 // https://stackoverflow.com/questions/47981/how-do-you-set-clear-and-toggle-a-single-bit#:~:text=Toggling%20a%20bit,n%20th%20bit%20of%20number%20.
 
 
-const unsigned int START_ADDRESS = 0x200;
 const unsigned int FONT_START_ADDRESS = 0x50;
 const unsigned int FONTSET_SIZE = 80;
 
@@ -44,31 +48,19 @@ uint8_t fontset[FONTSET_SIZE] =
 	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
-				//this part is weird need to do more research on this
-				//apparentally called an initialization list.
-				//we have the member (or variable to make it easier to understand)
-				//followed by (), inside of the paranthesis is what we are initialzing
-//Constructor	//the member too.
-Chip8::Chip8() : randomSeed(std::chrono::system_clock::now().time_since_epoch().count())
+//every opcode we dont know about should land on OP_NULL
+//instead of a null member function pointer.
+//the tables are built by the compiler (the lambdas run at compile time),
+//so every instance shares them and constructing a Chip8 costs nothing
+
+//this table is the main table.
+//it looks at the 4 bits of the opcode (the left most bits)
+//if the first 4 bits equals 0, 8, E, or F then it will call
+//one of the Table Functions.
+//else it will call one of the opcode functions
+const std::array<Chip8::Chip8Func, 0xF + 1> Chip8::table = []()
 {
-	//chip8 memory is reserved from addresses 0x000 to 0x1FF
-	//so ROM instructions start at 0x200
-	pc = START_ADDRESS;
-
-	//add the fonts to memory
-	for (unsigned int i = 0; i < FONTSET_SIZE; ++i)
-	{
-		memory[FONT_START_ADDRESS + i] = fontset[i];
-	}
-
-	//this is the actual generator. it will generate a random byte from 0 to 255;
-	randomByte = std::uniform_int_distribution<short>(0, 255u);
-
-	//this table is the main table.
-	//it looks at the 4 bits of the opcode (the left most bits)
-	//if the first 4 bits equals 0, 8, E, or F then it will call
-	//one of the Table Functions.
-	//else it will call one of the opcode functions
+	std::array<Chip8Func, 0xF + 1> table{};
 	table[0x0] = &Chip8::Table0;
 	table[0x1] = &Chip8::OP_1NNN;
 	table[0x2] = &Chip8::OP_2NNN;
@@ -85,14 +77,26 @@ Chip8::Chip8() : randomSeed(std::chrono::system_clock::now().time_since_epoch().
 	table[0xD] = &Chip8::OP_DXYN;
 	table[0xE] = &Chip8::TableE;
 	table[0xF] = &Chip8::TableF;
+	return table;
+}();
 
-	//if first 4 bits equals 0 then check last 4 bits
-	//of opcode with table0 to call opcode function
+//if first 4 bits equals 0 then check last 4 bits
+//of opcode with table0 to call opcode function
+const std::array<Chip8::Chip8Func, 0xF + 1> Chip8::table0 = []()
+{
+	std::array<Chip8Func, 0xF + 1> table0{};
+	for (Chip8Func& func : table0) { func = &Chip8::OP_NULL; }
 	table0[0x0] = &Chip8::OP_00E0;
 	table0[0xE] = &Chip8::OP_00EE;
+	return table0;
+}();
 
-	//if first 4 bits equals 8 then check last 4 bits
-	//of opcode with table8 to call opcode function
+//if first 4 bits equals 8 then check last 4 bits
+//of opcode with table8 to call opcode function
+const std::array<Chip8::Chip8Func, 0xF + 1> Chip8::table8 = []()
+{
+	std::array<Chip8Func, 0xF + 1> table8{};
+	for (Chip8Func& func : table8) { func = &Chip8::OP_NULL; }
 	table8[0x0] = &Chip8::OP_8XY0;
 	table8[0x1] = &Chip8::OP_8XY1;
 	table8[0x2] = &Chip8::OP_8XY2;
@@ -102,14 +106,26 @@ Chip8::Chip8() : randomSeed(std::chrono::system_clock::now().time_since_epoch().
 	table8[0x6] = &Chip8::OP_8XY6;
 	table8[0x7] = &Chip8::OP_8XY7;
 	table8[0xE] = &Chip8::OP_8XYE;
+	return table8;
+}();
 
-	//if first 4 bits equals E then check last 4 bits
-	//of opcode with tableE to call opcode function
+//if first 4 bits equals E then check last 4 bits
+//of opcode with tableE to call opcode function
+const std::array<Chip8::Chip8Func, 0xF + 1> Chip8::tableE = []()
+{
+	std::array<Chip8Func, 0xF + 1> tableE{};
+	for (Chip8Func& func : tableE) { func = &Chip8::OP_NULL; }
 	tableE[0x1] = &Chip8::OP_EXA1;
 	tableE[0xE] = &Chip8::OP_EX9E;
+	return tableE;
+}();
 
-	//if first 4 bits equals F then check last 4 bits
-	//of opcode with tableF to call opcode function
+//if first 4 bits equals F then check last 4 bits
+//of opcode with tableF to call opcode function
+const std::array<Chip8::Chip8Func, 0xFF + 1> Chip8::tableF = []()
+{
+	std::array<Chip8Func, 0xFF + 1> tableF{};
+	for (Chip8Func& func : tableF) { func = &Chip8::OP_NULL; }
 	tableF[0x07] = &Chip8::OP_FX07;
 	tableF[0x0A] = &Chip8::OP_FX0A;
 	tableF[0x15] = &Chip8::OP_FX15;
@@ -119,6 +135,113 @@ Chip8::Chip8() : randomSeed(std::chrono::system_clock::now().time_since_epoch().
 	tableF[0x33] = &Chip8::OP_FX33;
 	tableF[0x55] = &Chip8::OP_FX55;
 	tableF[0x65] = &Chip8::OP_FX65;
+	return tableF;
+}();
+
+				//this part is weird need to do more research on this
+				//apparentally called an initialization list.
+				//we have the member (or variable to make it easier to understand)
+				//followed by (), inside of the paranthesis is what we are initialzing
+//Constructor	//the member too.
+Chip8::Chip8() : Chip8((uint64_t)std::chrono::system_clock::now().time_since_epoch().count())
+{
+}
+
+//the seed is the only thing that changes between two runs of the same ROM
+//with the same input, so a fixed seed makes a run reproducible
+Chip8::Chip8(uint64_t seed, uint64_t stream) : randomKey(Chip8Random::Key(seed, stream))
+{
+	//chip8 memory is reserved from addresses 0x000 to 0x1FF
+	//so ROM instructions start at 0x200
+	pc = START_ADDRESS;
+
+	//add the fonts to memory. every machine starts out sharing one block
+	//that already has them, the first write gives it a copy of its own
+	LoadImage(PowerOnImage());
+}
+
+Chip8::Image const& Chip8::PowerOnImage()
+{
+	//made the first time a machine is constructed (a function static is thread safe)
+	static Image const image = []()
+	{
+		Image powerOn;
+		powerOn.memory.reset(new uint8_t[MEMORY_SIZE + MEMORY_PADDING]());
+
+		for (unsigned int i = 0; i < FONTSET_SIZE; ++i)
+		{
+			powerOn.memory[FONT_START_ADDRESS + i] = fontset[i];
+			powerOn.memoryHash ^= ZobristByte(FONT_START_ADDRESS + i, fontset[i]);
+		}
+
+		return powerOn;
+	}();
+
+	return image;
+}
+
+Chip8::Image Chip8::SharedImage(uint8_t const* data, size_t size)
+{
+	//every ROM a fresh machine loaded, by the hash of its bytes. only weakly
+	//held, the last machine that uses a block frees it. what stays behind is
+	//one small entry per different ROM
+	struct SharedRom
+	{
+		std::weak_ptr<uint8_t[]> memory;
+		uint64_t memoryHash;
+		size_t size;
+	};
+	static std::mutex lock;
+	static std::unordered_map<uint64_t, SharedRom> roms;
+
+	uint64_t key = 0xCBF29CE484222325ull ^ size;
+	for (size_t i = 0; i < size; ++i)
+	{
+		key ^= data[i];
+		key *= 0x100000001B3ull;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	SharedRom& rom = roms[key];
+	Image image{ rom.memory.lock(), rom.memoryHash };
+	if (image.memory && rom.size == size && memcmp(&image.memory[START_ADDRESS], data, size) == 0)
+	{
+		return image;
+	}
+
+	//the font, then the ROM right after the reserved area, the same bytes
+	//LoadROM leaves in a fresh machine. everything after it is still 0
+	Image const& powerOn = PowerOnImage();
+	image.memory.reset(new uint8_t[MEMORY_SIZE + MEMORY_PADDING]);
+	memcpy(image.memory.get(), powerOn.memory.get(), MEMORY_SIZE + MEMORY_PADDING);
+	memcpy(&image.memory[START_ADDRESS], data, size);
+
+	image.memoryHash = powerOn.memoryHash;
+	for (size_t i = 0; i < size; ++i)
+	{
+		image.memoryHash ^= ZobristByte(START_ADDRESS + (unsigned int)i, data[i]);
+	}
+
+	rom = SharedRom{ image.memory, image.memoryHash, size };
+	return image;
+}
+
+bool Chip8::MakeImage(uint8_t const* data, size_t size, Image& image)
+{
+	if (size > MEMORY_SIZE - START_ADDRESS)
+	{
+		return false;
+	}
+
+	image = SharedImage(data, size);
+	return true;
+}
+
+void Chip8::LoadImage(Image const& image)
+{
+	ShareMemory(image.memory);
+	memoryHash = image.memoryHash;
 }
 
 //Deconstructor
@@ -134,9 +257,9 @@ Parameters:
 fileName = Name of the ROM file
 
 Returns:
-Absolutely nothing
+true if the ROM was opened, fits in memory and was loaded, false otherwise
 */
-void Chip8::LoadROM(char const* fileName) 
+bool Chip8::LoadROM(char const* fileName) 
 {
 	//open file stream.
 	//ios::ate = start at the end of the file
@@ -154,26 +277,286 @@ void Chip8::LoadROM(char const* fileName)
 		//current character in the input stream.
 		//return type is std::streampos
 		std::streampos size = file.tellg();
-		char* buffer = new char[size];
+
+		//FIX: a ROM bigger than the program area used to be copied past the
+		//end of memory. now it is refused before anything is read
+		if (size < 0 || (uint64_t)size > MEMORY_SIZE - START_ADDRESS)
+		{
+			return false;
+		}
+
+		//the largest ROM there can be is only 3.5 KB, so the buffer lives
+		//on the stack instead of being allocated for every load
+		uint8_t buffer[MEMORY_SIZE - START_ADDRESS];
 
 		//go back to the beginning of the file and fill the buffer
 		//0 is the offset value relative to the 2nd argument (in this case the beginning)
 		file.seekg(0, std::ios::beg);
 		//contents of file go to the buffer and we specify
 		//how many characters to read (which we got from file.tellg)
-		file.read(buffer, size);
-		file.close();
+		if (!file.read(reinterpret_cast<char*>(buffer), size))
+		{
+			return false;
+		}
 
 		//now that we have the contents of the ROM, its time to load
-		//it to memory
-		for (long i = 0; i < size; ++i) 
+		//it to memory, the same way a ROM that is already in memory is
+		return LoadROM(buffer, (size_t)size);
+	}
+
+	return false;
+}
+
+/*
+Load a ROM that is already in memory (for example one that is built into the program)
+
+Parameters:
+data = the ROM bytes
+size = number of bytes
+
+Returns:
+true if the ROM fits in memory and was loaded, false otherwise
+*/
+bool Chip8::LoadROM(uint8_t const* data, size_t size)
+{
+	if (size > MEMORY_SIZE - START_ADDRESS)
+	{
+		return false;
+	}
+
+	//a machine that still has nothing but the font in memory ends up with
+	//exactly the memory of every other one that loaded this ROM, so it shares
+	//theirs. the ROM only gets copied for a machine that writes to it
+	if (memoryBlock == PowerOnImage().memory)
+	{
+		LoadImage(SharedImage(data, size));
+		return true;
+	}
+
+	WritableMemory();
+	HashMemoryWrite(START_ADDRESS, data, size);
+	memcpy(&memory[START_ADDRESS], data, size);
+	InvalidateCode(START_ADDRESS, MEMORY_SIZE - 1);
+
+	return true;
+}
+
+/*
+Turn the 1 bit per pixel screen into 32 bit RGBA pixels for presenting
+
+Parameters:
+pixels = VIDEO_WIDTH * VIDEO_HEIGHT pixels, row by row
+*/
+void Chip8::ExpandVideo(uint32_t* pixels) const
+{
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; ++y)
+	{
+		uint64_t screenRow = video[y];
+
+		for (unsigned int x = 0; x < VIDEO_WIDTH; ++x)
+		{
+			//0 - 1 = 0xFFFFFFFF for a pixel that is on, 0 - 0 = 0 for one that is off
+			pixels[y * VIDEO_WIDTH + x] = 0u - (uint32_t)((screenRow >> (VIDEO_WIDTH - 1 - x)) & 1u);
+		}
+	}
+}
+
+void Chip8::SaveState(Chip8State& state) const
+{
+	memcpy(state.memory, memory, MEMORY_SIZE);
+	memcpy(state.registers, registers, sizeof(registers));
+	state.index = index;
+	state.pc = pc;
+	memcpy(state.stack, stack, sizeof(stack));
+	state.sp = sp;
+	state.delay = delay;
+	state.sound = sound;
+	memcpy(state.keypad, keypad, sizeof(keypad));
+	memcpy(state.video, video, sizeof(video));
+	state.randomKey = randomKey;
+	state.randomCounter = randomCounter;
+}
+
+void Chip8::LoadState(Chip8State const& state)
+{
+	//find the bytes that change, code translated from anything else stays valid.
+	//for a rewind or a reload of the same game that is usually nothing at all
+	if (memcmp(memory, state.memory, MEMORY_SIZE) != 0)
+	{
+		unsigned int first = 0;
+		while (memory[first] == state.memory[first])
+		{
+			++first;
+		}
+
+		unsigned int last = MEMORY_SIZE - 1;
+		while (memory[last] == state.memory[last])
+		{
+			--last;
+		}
+
+		WritableMemory();
+		HashMemoryWrite(first, &state.memory[first], last - first + 1);
+		memcpy(&memory[first], &state.memory[first], last - first + 1);
+		InvalidateCode(first, last);
+	}
+
+	memcpy(registers, state.registers, sizeof(registers));
+	index = state.index;
+	pc = state.pc;
+	memcpy(stack, state.stack, sizeof(stack));
+	sp = state.sp;
+	delay = state.delay;
+	sound = state.sound;
+	memcpy(keypad, state.keypad, sizeof(keypad));
+	for (unsigned int row = 0; row < VIDEO_HEIGHT; ++row)
+	{
+		videoHash ^= ZobristRow(row, video[row] ^ state.video[row]);
+	}
+	memcpy(video, state.video, sizeof(video));
+	randomKey = state.randomKey;
+	randomCounter = state.randomCounter;
+}
+
+//the private constructor for Fork. it leaves out the memory block
+//and the font, the parent has both already
+Chip8::Chip8(Chip8 const& parent, uint64_t stream)
+{
+	ShareMemory(parent.memoryBlock);
+	CopyForkState(parent, stream);
+}
+
+std::unique_ptr<Chip8> Chip8::Fork(uint64_t stream) const
+{
+	return std::unique_ptr<Chip8>(new Chip8(*this, stream));
+}
+
+void Chip8::ForkInto(Chip8& into, uint64_t stream) const
+{
+	if (&into == this)
+	{
+		return;
+	}
+
+	into.ShareMemory(memoryBlock);
+	into.CopyForkState(*this, stream);
+}
+
+void Chip8::CopyForkState(Chip8 const& parent, uint64_t stream)
+{
+	memcpy(registers, parent.registers, sizeof(registers));
+	index = parent.index;
+	pc = parent.pc;
+	delay = parent.delay;
+	sound = parent.sound;
+	memcpy(stack, parent.stack, sizeof(stack));
+	sp = parent.sp;
+	opcode = parent.opcode;
+	memcpy(keypad, parent.keypad, sizeof(keypad));
+	memcpy(video, parent.video, sizeof(video));
+	memoryHash = parent.memoryHash;
+	videoHash = parent.videoHash;
+	fusedSkipped = 0;
+
+	//a new stream under the parent's key: forks with different streams get
+	//different numbers, and forking again with the same stream repeats them
+	randomKey = Chip8Random::Key(parent.randomKey, stream);
+	randomCounter = 0;
+
+	SetDispatch(parent.dispatch);
+}
+
+void Chip8::CopyMemory()
+{
+	std::shared_ptr<uint8_t[]> copy(new uint8_t[MEMORY_SIZE + MEMORY_PADDING]);
+	memcpy(copy.get(), memory, MEMORY_SIZE + MEMORY_PADDING);
+	memoryBlock = copy;
+	memory = memoryBlock.get();
+	privateMemory = true;
+}
+
+void Chip8::HashMemoryWrite(unsigned int first, uint8_t const* bytes, size_t count)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		unsigned int address = first + (unsigned int)i;
+		memoryHash ^= ZobristByte(address, memory[address]) ^ ZobristByte(address, bytes[i]);
+	}
+}
+
+uint64_t Chip8::HashCpu() const
+{
+	//only the entries below sp are ever read again
+	unsigned int live = sp < STACK_LEVELS ? sp : STACK_LEVELS;
+	uint64_t words[4];
+	memcpy(words, registers, sizeof(registers));
+	words[2] = ((uint64_t)index << 48u) | ((uint64_t)pc << 32u) | ((uint64_t)sp << 16u) | ((uint64_t)delay << 8u) | sound;
+	words[3] = randomCounter;
+
+	uint64_t hash = randomKey;
+	for (uint64_t word : words)
+	{
+		hash = SplitMixRandom::Mix(hash ^ word);
+	}
+	for (unsigned int level = 0; level < live; ++level)
+	{
+		hash = SplitMixRandom::Mix(hash ^ stack[level]);
+	}
+
+	return hash;
+}
+
+uint64_t Chip8::StateHash() const
+{
+	return memoryHash ^ videoHash ^ HashCpu();
+}
+
+uint64_t Chip8::ComputeStateHash() const
+{
+	uint64_t hash = HashCpu();
+
+	for (unsigned int address = 0; address < MEMORY_SIZE + MEMORY_PADDING; ++address)
+	{
+		hash ^= ZobristByte(address, memory[address]);
+	}
+
+	for (unsigned int row = 0; row < VIDEO_HEIGHT; ++row)
+	{
+		hash ^= ZobristRow(row, video[row]);
+	}
+
+	return hash;
+}
+
+void Chip8::ShareMemory(std::shared_ptr<uint8_t[]> const& block)
+{
+	privateMemory = false;
+
+	if (block == memoryBlock)
+	{
+		return;
+	}
+
+	//same idea as LoadState, code translated from memory that stays the same stays valid
+	if (memory != nullptr && memcmp(memory, block.get(), MEMORY_SIZE) != 0)
+	{
+		unsigned int first = 0;
+		while (memory[first] == block[first])
+		{
+			++first;
+		}
+
+		unsigned int last = MEMORY_SIZE - 1;
+		while (memory[last] == block[last])
 		{
-			memory[START_ADDRESS + i] = buffer[i];
+			--last;
 		}
 
-		//keyword for deleting arrays from memory in c++
-		delete[] buffer;
+		InvalidateCode(first, last);
 	}
+
+	memoryBlock = block;
+	memory = memoryBlock.get();
 }
 
 void Chip8::Cycle()
@@ -187,6 +570,20 @@ void Chip8::Cycle()
 	//since we already have the opcode, we can increment the program counter
 	pc += 2;
 
+#if CHIP8_PROFILE
+	profile.Count(pc - 2, opcode);
+
+	//only the draws get timed, reading the clock for every instruction
+	//would cost more than most of them
+	if ((opcode & 0xF000u) == 0xD000u)
+	{
+		auto start = std::chrono::steady_clock::now();
+		OP_DXYN();
+		profile.Draw((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		return;
+	}
+#endif
+
 	//Decode & Fetch
 	//(*this) = dereferenced pointer. so returns the object
 	//			instead of a pointer to the current object (this)
@@ -196,7 +593,10 @@ void Chip8::Cycle()
 	//so the *table[value] dereferences that pointer
 	//which results in the function being called
 	((*this).*(table[(opcode & 0xF000u) >> 12u]))();
+}
 
+void Chip8::TickTimers()
+{
 	// Decrement the delay timer if it's been set
 	if (delay > 0)
 	{
@@ -241,6 +641,7 @@ void Chip8::OP_00E0()
 {
 	//sets the entire video buffer to zeroes
 	memset(video, 0, sizeof(video));
+	videoHash = 0;
 }
 
 /* 00EE: RET
@@ -490,9 +891,8 @@ void Chip8::OP_CXKK()
 	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 	uint8_t byte = (opcode & 0x00FFu);
 
-	//random byte produces a value between 0x0000 and 0x00FF
-	//just in case, i cast to uint8_t....just to be safe...hopefully
-	uint8_t r = (uint8_t)(randomByte(randomSeed) & byte);
+	//the next number of our stream, the low byte is as random as any other
+	uint8_t r = (uint8_t)(Chip8Random::Next(randomKey, randomCounter++) & byte);
 	registers[Vx] = r;
 }
 
@@ -514,31 +914,24 @@ void Chip8::OP_DXYN()
 	uint8_t xPos = registers[Vx] % VIDEO_WIDTH;
 	uint8_t yPos = registers[Vy] % VIDEO_HEIGHT;
 
-	for (unsigned int row = 0; row < height; ++row)
+	//every row of the screen is one uint64_t, the left most pixel is the top bit.
+	//so a sprite row is the sprite byte moved to the top of a uint64_t and then
+	//right by xPos. anything that goes past the right edge falls off the end,
+	//rows past the bottom edge are not drawn at all (clipping)
+	for (unsigned int row = 0; row < height && yPos + row < VIDEO_HEIGHT; ++row)
 	{
+		uint64_t spriteRow = ((uint64_t)memory[index + row] << 56u) >> xPos;
+		uint64_t& screenRow = video[yPos + row];
 
-		uint8_t spriteByte = memory[index + row];
-
-		for (unsigned int col = 0; col < 8; ++col)
+		// A pixel that is on in both - collision
+		if ((screenRow & spriteRow) != 0)
 		{
-			uint8_t spritePixel = spriteByte & (0x80u >> col);
-
-			//screenPixel is a pointer to the pixel
-			uint32_t* screenPixel = &video[(yPos + row) * VIDEO_WIDTH + (xPos + col)];
-
-			// Sprite pixel is on
-			if (spritePixel)
-			{
-				// Screen pixel also on - collision
-				if (*screenPixel == 0xFFFFFFFF)
-				{
-					registers[0xF] = 1;
-				}
-
-				// Effectively XOR with the sprite pixel (XOR Toggles)
-				*screenPixel ^= 0xFFFFFFFF;
-			}
+			registers[0xF] = 1;
 		}
+
+		// XOR toggles the pixels of the sprite
+		videoHash ^= ZobristSprite(yPos + row, xPos, memory[index + row]);
+		screenRow ^= spriteRow;
 	}
 }
 
@@ -709,16 +1102,25 @@ void Chip8::OP_FX33()
 	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 	uint8_t value = registers[Vx];
 
+	WritableMemory();
+
+	uint8_t digits[3];
+
 	// Ones-place
-	memory[index + 2] = value % 10;
+	digits[2] = value % 10;
 	value /= 10;
 
 	// Tens-place
-	memory[index + 1] = value % 10;
+	digits[1] = value % 10;
 	value /= 10;
 
 	// Hundreds-place
-	memory[index] = value % 10;
+	digits[0] = value % 10;
+
+	HashMemoryWrite(index, digits, 3);
+	memcpy(&memory[index], digits, 3);
+
+	InvalidateCode(index, index + 2);
 }
 
 /* FX55: LD [I], Vx
@@ -728,10 +1130,17 @@ void Chip8::OP_FX55()
 {
 	uint8_t Vx = (opcode & 0x0F00u) >> 8u;
 
+	WritableMemory();
+
+	HashMemoryWrite(index, registers, Vx + 1u);
+
+	//FIX: this used to write to memory[i + 1], the registers go to I, I+1, ...
 	for (uint8_t i = 0; i <= Vx; ++i)
 	{
-		memory[i + 1] = registers[i];
+		memory[index + i] = registers[i];
 	}
+
+	InvalidateCode(index, index + Vx);
 }
 
 /* FX65: LD Vx, [I]
@@ -746,3 +1155,963 @@ void Chip8::OP_FX65()
 		registers[i] = memory[index + i];
 	}
 }
+
+
+/***************************************************
+*  Interpreter cores                               *
+*                                                  *
+*  Cycle() goes through table and then one of the  *
+*  Table0/8/E/F functions, so most instructions    *
+*  cost two indirect calls. The cores below run    *
+*  the exact same OP_* handlers and pick one with  *
+*  Run() / SetDispatch(), so we can measure which  *
+*  one is the fastest on a given machine.          *
+***************************************************/
+
+/*
+Run a number of cycles with the selected core
+
+Parameters:
+cycles = how many instructions to execute
+
+Returns:
+the number of instructions that were executed
+*/
+uint64_t Chip8::Run(uint64_t cycles)
+{
+#if CHIP8_PROFILE
+	//the profile is collected in Cycle(), which only the Table core goes through.
+	//no fast-forwarding either, the profile should see every instruction
+	RunTable(cycles);
+#else
+	uint64_t skipped = idleSkip ? SkipIdle(cycles) : 0;
+	uint64_t left = cycles - skipped;
+
+	switch (dispatch)
+	{
+		case Dispatch::Table:
+			RunTable(left);
+			break;
+		case Dispatch::Switch:
+			RunSwitch(left);
+			break;
+		case Dispatch::Goto:
+			RunGoto(left);
+			break;
+		case Dispatch::Flat:
+			RunFlat(left);
+			break;
+		case Dispatch::Decoded:
+		case Dispatch::Fused:
+			RunDecoded(left);
+			break;
+		case Dispatch::Jit:
+			RunJit(left);
+			break;
+	}
+#endif
+
+	return cycles;
+}
+
+//longest idle loop we look for, in instructions
+const unsigned int MAX_IDLE_LOOP = 8;
+
+/*
+Find out if the machine is in an idle loop and fast-forward it if it is.
+
+the instructions from pc on are run one by one with Cycle(), and they are all
+real progress, until either something that is never idle comes up (a write to
+memory or the screen, a random number, a call or return), the loop gets too
+long, or pc is back where it started. if the registers, I and the timers are
+then the same as the last time pc was there, every further lap does exactly the
+same: inside a run the keys and the timers cant change, and nothing else was
+touched. so all the whole laps that still fit are skipped at once, and the rest
+is left to the core. the first lap is allowed to change something (a loop
+entered in the middle, FX07 picking up a delay that ticked since the last run)
+
+a start pc where nothing was found (or the run ended first) is not run through
+here again until the code that was run changes or a longer run comes
+(idleFailed), unless the keys or the timer took part in the answer
+
+Returns:
+the number of cycles that were run or skipped
+*/
+uint64_t Chip8::SkipIdle(uint64_t cycles)
+{
+	idle = IdleState::Running;
+
+	//a pc that ran out of cycles could still be an idle loop in a longer run
+	if (cycles > idleCycles)
+	{
+		ForgetIdle();
+		idleCycles = cycles;
+	}
+
+	uint16_t start = pc;
+	if (start < MEMORY_SIZE && idleFailed[start])
+	{
+		return 0;
+	}
+
+	uint8_t lapRegisters[REGISTER_COUNT];
+	memcpy(lapRegisters, registers, sizeof(registers));
+	uint16_t lapIndex = index;
+	uint8_t lapDelay = delay;
+	uint8_t lapSound = sound;
+
+	bool firstLap = true;
+	bool readsTimer = false;
+	bool readsKeys = false;
+	unsigned int length = 0;
+	uint64_t done = 0;
+	uint16_t low = pc;
+	uint16_t high = pc;
+
+	while (done < cycles)
+	{
+		low = pc < low ? pc : low;
+		high = pc > high ? pc : high;
+		uint16_t next = (memory[pc] << 8u) | memory[pc + 1];
+
+		switch (next >> 12u)
+		{
+			case 0x0:
+				//00E0 and 00EE, the rest are OP_NULL and do nothing
+				if ((next & 0x000Fu) == 0x0 || (next & 0x000Fu) == 0xE)
+				{
+					return NotIdle(start, low, high, readsTimer || readsKeys, done);
+				}
+				break;
+			case 0x2:
+			case 0xC:
+			case 0xD:
+				return NotIdle(start, low, high, readsTimer || readsKeys, done);
+			case 0xE:
+				readsKeys = true;
+				break;
+			case 0xF:
+				switch (next & 0x00FFu)
+				{
+					case 0x07: readsTimer = true; break;
+					case 0x0A: readsKeys = true; break;
+					case 0x33:
+					case 0x55:
+						return NotIdle(start, low, high, readsTimer || readsKeys, done);
+				}
+				break;
+		}
+
+		Cycle();
+		++done;
+		++length;
+
+		if (pc != start)
+		{
+			if (length >= MAX_IDLE_LOOP)
+			{
+				return NotIdle(start, low, high, readsTimer || readsKeys, done);
+			}
+			continue;
+		}
+
+		if (memcmp(registers, lapRegisters, sizeof(registers)) == 0 && index == lapIndex &&
+			delay == lapDelay && sound == lapSound)
+		{
+			//a fixed point: skip every whole lap that is left
+			uint64_t left = cycles - done;
+			done += left - left % length;
+
+			idle = readsTimer && delay != 0 ? IdleState::WaitTimer : readsKeys ? IdleState::WaitKey : IdleState::Halted;
+			return done;
+		}
+
+		if (!firstLap)
+		{
+			return NotIdle(start, low, high, readsTimer || readsKeys, done);
+		}
+
+		firstLap = false;
+		length = 0;
+		memcpy(lapRegisters, registers, sizeof(registers));
+		lapIndex = index;
+		lapDelay = delay;
+		lapSound = sound;
+	}
+
+	return NotIdle(start, low, high, readsTimer || readsKeys, done);
+}
+
+uint64_t Chip8::NotIdle(uint16_t start, uint16_t low, uint16_t high, bool readsInput, uint64_t done)
+{
+	if (!readsInput && start < MEMORY_SIZE)
+	{
+		idleFailed[start] = true;
+		idleFirst = low < idleFirst ? low : idleFirst;
+		idleLast = high + 1u > idleLast ? high + 1u : idleLast;
+	}
+
+	return done;
+}
+
+void Chip8::ForgetIdle()
+{
+	idleFailed.reset();
+	idleFirst = MEMORY_SIZE;
+	idleLast = 0;
+}
+
+void Chip8::SetDispatch(Dispatch mode)
+{
+	//Decoded and Fused fill the decoded entries differently
+	if ((mode == Dispatch::Fused) != (dispatch == Dispatch::Fused))
+	{
+		decoded.reset();
+	}
+
+	dispatch = mode;
+}
+
+void Chip8::RunTable(uint64_t cycles)
+{
+	for (uint64_t i = 0; i < cycles; ++i)
+	{
+		Cycle();
+	}
+}
+
+//the sub switches look at the same bits as Table0/8/E/F do
+//(the last nibble, or the last byte for F), so an opcode like 0x0120
+//still ends up in OP_00E0 exactly like it does with the tables.
+void Chip8::RunSwitch(uint64_t cycles)
+{
+	for (uint64_t i = 0; i < cycles; ++i)
+	{
+		opcode = (memory[pc] << 8u) | memory[pc + 1];
+		pc += 2;
+
+		switch (opcode >> 12u)
+		{
+			case 0x0:
+				switch (opcode & 0x000Fu)
+				{
+					case 0x0: OP_00E0(); break;
+					case 0xE: OP_00EE(); break;
+				}
+				break;
+			case 0x1: OP_1NNN(); break;
+			case 0x2: OP_2NNN(); break;
+			case 0x3: OP_3XKK(); break;
+			case 0x4: OP_4XKK(); break;
+			case 0x5: OP_5XY0(); break;
+			case 0x6: OP_6XKK(); break;
+			case 0x7: OP_7XKK(); break;
+			case 0x8:
+				switch (opcode & 0x000Fu)
+				{
+					case 0x0: OP_8XY0(); break;
+					case 0x1: OP_8XY1(); break;
+					case 0x2: OP_8XY2(); break;
+					case 0x3: OP_8XY3(); break;
+					case 0x4: OP_8XY4(); break;
+					case 0x5: OP_8XY5(); break;
+					case 0x6: OP_8XY6(); break;
+					case 0x7: OP_8XY7(); break;
+					case 0xE: OP_8XYE(); break;
+				}
+				break;
+			case 0x9: OP_9XY0(); break;
+			case 0xA: OP_ANNN(); break;
+			case 0xB: OP_BNNN(); break;
+			case 0xC: OP_CXKK(); break;
+			case 0xD: OP_DXYN(); break;
+			case 0xE:
+				switch (opcode & 0x000Fu)
+				{
+					case 0x1: OP_EXA1(); break;
+					case 0xE: OP_EX9E(); break;
+				}
+				break;
+			case 0xF:
+				switch (opcode & 0x00FFu)
+				{
+					case 0x07: OP_FX07(); break;
+					case 0x0A: OP_FX0A(); break;
+					case 0x15: OP_FX15(); break;
+					case 0x18: OP_FX18(); break;
+					case 0x1E: OP_FX1E(); break;
+					case 0x29: OP_FX29(); break;
+					case 0x33: OP_FX33(); break;
+					case 0x55: OP_FX55(); break;
+					case 0x65: OP_FX65(); break;
+				}
+				break;
+		}
+	}
+}
+
+#if defined(__GNUC__)
+//threaded code: every handler jumps straight to the handler of the next
+//instruction through a table of label addresses ("labels as values").
+//there is no loop and no shared dispatch branch, so the branch predictor
+//gets one indirect jump per handler to learn from.
+void Chip8::RunGoto(uint64_t cycles)
+{
+	static void* const labels[0xF + 1] =
+	{
+		&&L_TABLE0, &&L_1NNN, &&L_2NNN, &&L_3XKK, &&L_4XKK, &&L_5XY0, &&L_6XKK, &&L_7XKK,
+		&&L_TABLE8, &&L_9XY0, &&L_ANNN, &&L_BNNN, &&L_CXKK, &&L_DXYN, &&L_TABLEE, &&L_TABLEF
+	};
+	static void* const labels0[0xF + 1] =
+	{
+		&&L_00E0, &&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL,
+		&&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_00EE, &&L_NULL
+	};
+	static void* const labels8[0xF + 1] =
+	{
+		&&L_8XY0, &&L_8XY1, &&L_8XY2, &&L_8XY3, &&L_8XY4, &&L_8XY5, &&L_8XY6, &&L_8XY7,
+		&&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_8XYE, &&L_NULL
+	};
+	static void* const labelsE[0xF + 1] =
+	{
+		&&L_NULL, &&L_EXA1, &&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL,
+		&&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_NULL, &&L_EX9E, &&L_NULL
+	};
+
+	uint64_t remaining = cycles;
+
+	//finish the instruction we just ran, then fetch and jump to the next one
+#define CHIP8_NEXT() \
+	if (--remaining == 0) { return; } \
+	opcode = (memory[pc] << 8u) | memory[pc + 1]; \
+	pc += 2; \
+	goto *labels[opcode >> 12u]
+
+	if (remaining == 0)
+	{
+		return;
+	}
+
+	opcode = (memory[pc] << 8u) | memory[pc + 1];
+	pc += 2;
+	goto *labels[opcode >> 12u];
+
+L_TABLE0: goto *labels0[opcode & 0x000Fu];
+L_TABLE8: goto *labels8[opcode & 0x000Fu];
+L_TABLEE: goto *labelsE[opcode & 0x000Fu];
+L_TABLEF:
+	//only 9 of the 256 low bytes are used, a switch is smaller than a 256 label table
+	switch (opcode & 0x00FFu)
+	{
+		case 0x07: goto L_FX07;
+		case 0x0A: goto L_FX0A;
+		case 0x15: goto L_FX15;
+		case 0x18: goto L_FX18;
+		case 0x1E: goto L_FX1E;
+		case 0x29: goto L_FX29;
+		case 0x33: goto L_FX33;
+		case 0x55: goto L_FX55;
+		case 0x65: goto L_FX65;
+		default: goto L_NULL;
+	}
+
+L_NULL: CHIP8_NEXT();
+L_00E0: OP_00E0(); CHIP8_NEXT();
+L_00EE: OP_00EE(); CHIP8_NEXT();
+L_1NNN: OP_1NNN(); CHIP8_NEXT();
+L_2NNN: OP_2NNN(); CHIP8_NEXT();
+L_3XKK: OP_3XKK(); CHIP8_NEXT();
+L_4XKK: OP_4XKK(); CHIP8_NEXT();
+L_5XY0: OP_5XY0(); CHIP8_NEXT();
+L_6XKK: OP_6XKK(); CHIP8_NEXT();
+L_7XKK: OP_7XKK(); CHIP8_NEXT();
+L_8XY0: OP_8XY0(); CHIP8_NEXT();
+L_8XY1: OP_8XY1(); CHIP8_NEXT();
+L_8XY2: OP_8XY2(); CHIP8_NEXT();
+L_8XY3: OP_8XY3(); CHIP8_NEXT();
+L_8XY4: OP_8XY4(); CHIP8_NEXT();
+L_8XY5: OP_8XY5(); CHIP8_NEXT();
+L_8XY6: OP_8XY6(); CHIP8_NEXT();
+L_8XY7: OP_8XY7(); CHIP8_NEXT();
+L_8XYE: OP_8XYE(); CHIP8_NEXT();
+L_9XY0: OP_9XY0(); CHIP8_NEXT();
+L_ANNN: OP_ANNN(); CHIP8_NEXT();
+L_BNNN: OP_BNNN(); CHIP8_NEXT();
+L_CXKK: OP_CXKK(); CHIP8_NEXT();
+L_DXYN: OP_DXYN(); CHIP8_NEXT();
+L_EXA1: OP_EXA1(); CHIP8_NEXT();
+L_EX9E: OP_EX9E(); CHIP8_NEXT();
+L_FX07: OP_FX07(); CHIP8_NEXT();
+L_FX0A: OP_FX0A(); CHIP8_NEXT();
+L_FX15: OP_FX15(); CHIP8_NEXT();
+L_FX18: OP_FX18(); CHIP8_NEXT();
+L_FX1E: OP_FX1E(); CHIP8_NEXT();
+L_FX29: OP_FX29(); CHIP8_NEXT();
+L_FX33: OP_FX33(); CHIP8_NEXT();
+L_FX55: OP_FX55(); CHIP8_NEXT();
+L_FX65: OP_FX65(); CHIP8_NEXT();
+
+#undef CHIP8_NEXT
+}
+#else
+//no labels as values on this compiler (MSVC), the switch core is the next best thing
+void Chip8::RunGoto(uint64_t cycles)
+{
+	RunSwitch(cycles);
+}
+#endif
+
+//works out the handler for one full opcode, using the same bits as the tables
+constexpr Chip8::FlatFunc Chip8::FlatEntry(uint16_t op)
+{
+	switch (op >> 12u)
+	{
+		case 0x0:
+			switch (op & 0x000Fu)
+			{
+				case 0x0: return &Call<&Chip8::OP_00E0>;
+				case 0xE: return &Call<&Chip8::OP_00EE>;
+			}
+			break;
+		case 0x1: return &Call<&Chip8::OP_1NNN>;
+		case 0x2: return &Call<&Chip8::OP_2NNN>;
+		case 0x3: return &Call<&Chip8::OP_3XKK>;
+		case 0x4: return &Call<&Chip8::OP_4XKK>;
+		case 0x5: return &Call<&Chip8::OP_5XY0>;
+		case 0x6: return &Call<&Chip8::OP_6XKK>;
+		case 0x7: return &Call<&Chip8::OP_7XKK>;
+		case 0x8:
+			switch (op & 0x000Fu)
+			{
+				case 0x0: return &Call<&Chip8::OP_8XY0>;
+				case 0x1: return &Call<&Chip8::OP_8XY1>;
+				case 0x2: return &Call<&Chip8::OP_8XY2>;
+				case 0x3: return &Call<&Chip8::OP_8XY3>;
+				case 0x4: return &Call<&Chip8::OP_8XY4>;
+				case 0x5: return &Call<&Chip8::OP_8XY5>;
+				case 0x6: return &Call<&Chip8::OP_8XY6>;
+				case 0x7: return &Call<&Chip8::OP_8XY7>;
+				case 0xE: return &Call<&Chip8::OP_8XYE>;
+			}
+			break;
+		case 0x9: return &Call<&Chip8::OP_9XY0>;
+		case 0xA: return &Call<&Chip8::OP_ANNN>;
+		case 0xB: return &Call<&Chip8::OP_BNNN>;
+		case 0xC: return &Call<&Chip8::OP_CXKK>;
+		case 0xD: return &Call<&Chip8::OP_DXYN>;
+		case 0xE:
+			switch (op & 0x000Fu)
+			{
+				case 0x1: return &Call<&Chip8::OP_EXA1>;
+				case 0xE: return &Call<&Chip8::OP_EX9E>;
+			}
+			break;
+		case 0xF:
+			switch (op & 0x00FFu)
+			{
+				case 0x07: return &Call<&Chip8::OP_FX07>;
+				case 0x0A: return &Call<&Chip8::OP_FX0A>;
+				case 0x15: return &Call<&Chip8::OP_FX15>;
+				case 0x18: return &Call<&Chip8::OP_FX18>;
+				case 0x1E: return &Call<&Chip8::OP_FX1E>;
+				case 0x29: return &Call<&Chip8::OP_FX29>;
+				case 0x33: return &Call<&Chip8::OP_FX33>;
+				case 0x55: return &Call<&Chip8::OP_FX55>;
+				case 0x65: return &Call<&Chip8::OP_FX65>;
+			}
+			break;
+	}
+
+	return &Call<&Chip8::OP_NULL>;
+}
+
+constexpr std::array<Chip8::FlatFunc, 0x10000> Chip8::MakeFlatTable()
+{
+	std::array<FlatFunc, 0x10000> result{};
+
+	for (uint32_t op = 0; op < 0x10000; ++op)
+	{
+		result[op] = FlatEntry((uint16_t)op);
+	}
+
+	return result;
+}
+
+//built by the compiler, so there is no startup cost and every instance shares it
+const std::array<Chip8::FlatFunc, 0x10000> Chip8::flatTable = Chip8::MakeFlatTable();
+
+void Chip8::RunFlat(uint64_t cycles)
+{
+	for (uint64_t i = 0; i < cycles; ++i)
+	{
+		opcode = (memory[pc] << 8u) | memory[pc + 1];
+		pc += 2;
+
+		flatTable[opcode](*this);
+	}
+}
+
+/***************************************************
+*  Pre-decoded core                                *
+*                                                  *
+*  The program area is decoded lazily, one entry   *
+*  per address. A decoded entry already knows its  *
+*  final handler (no Table0/8/E/F hop) and has     *
+*  X, Y, KK, N and NNN pulled out of the opcode.   *
+***************************************************/
+
+//longest sequence a superinstruction covers
+const unsigned int MAX_FUSED_LENGTH = 4;
+
+void Chip8::RunDecoded(uint64_t cycles)
+{
+	if (!decoded)
+	{
+		decoded.reset(new DecodedOp[MEMORY_SIZE - START_ADDRESS]{});
+	}
+
+	bool fuse = dispatch == Dispatch::Fused;
+
+	for (uint64_t i = 0; i < cycles; ++i)
+	{
+		//code outside of the program area (or running off the end of memory)
+		//is rare, it just goes through the flat table
+		if (pc < START_ADDRESS || pc >= MEMORY_SIZE - 1)
+		{
+			opcode = (memory[pc] << 8u) | memory[pc + 1];
+			pc += 2;
+			flatTable[opcode](*this);
+			continue;
+		}
+
+		DecodedOp& op = decoded[pc - START_ADDRESS];
+		if (op.handler == nullptr)
+		{
+			Decode(pc, op, fuse);
+		}
+
+		if (op.length > 1)
+		{
+			//a superinstruction only runs when the whole sequence fits in the budget,
+			//otherwise the first instruction runs on its own. that way we always stop
+			//on an instruction boundary, with the same state as the other cores
+			if (op.length > cycles - i)
+			{
+				opcode = op.opcode;
+				pc += 2;
+				flatTable[opcode](*this);
+				continue;
+			}
+
+			pc += 2;
+			op.handler(*this, op);
+
+			i += op.length - 1 - fusedSkipped;
+			fusedSkipped = 0;
+			continue;
+		}
+
+		pc += 2;
+		op.handler(*this, op);
+	}
+}
+
+void Chip8::RunJit(uint64_t cycles)
+{
+#if CHIP8_HAS_JIT
+	if (!jit)
+	{
+		jit.reset(new Chip8Jit(*this));
+	}
+
+	jit->Run(cycles);
+#else
+	RunDecoded(cycles);
+#endif
+}
+
+void Chip8::Decode(uint16_t address, DecodedOp& op, bool fuse)
+{
+	op.opcode = (memory[address] << 8u) | memory[address + 1];
+	op.nnn = op.opcode & 0x0FFFu;
+	op.x = (op.opcode & 0x0F00u) >> 8u;
+	op.y = (op.opcode & 0x00F0u) >> 4u;
+	op.kk = op.opcode & 0x00FFu;
+	op.n = op.opcode & 0x000Fu;
+	op.length = 1;
+	op.handler = DecodedEntry(op.opcode);
+
+	if (fuse)
+	{
+		Fuse(address, op);
+	}
+}
+
+/*
+Look for a sequence starting at address that has a superinstruction,
+and turn op into it if there is one.
+the entries of the other instructions in the sequence get decoded too,
+the superinstruction reads its operands from them.
+
+Parameters:
+address = address of op
+op = the (already decoded) entry of the first instruction
+
+Returns:
+true if op is now a superinstruction
+*/
+bool Chip8::Fuse(uint16_t address, DecodedOp& op)
+{
+	//how many instructions after this one are in the decoded area
+	unsigned int available = (MEMORY_SIZE - 1 - address) / 2;
+	if (available > MAX_FUSED_LENGTH)
+	{
+		available = MAX_FUSED_LENGTH;
+	}
+
+	auto next = [&](unsigned int i) -> uint16_t
+	{
+		return (memory[address + 2 * i] << 8u) | memory[address + 2 * i + 1];
+	};
+
+	unsigned int length = 1;
+	DecodedFunc handler = nullptr;
+
+	switch (op.opcode >> 12u)
+	{
+		case 0x6:
+			//a row of register loads, usually setting up a sprite position or a counter
+			while (length < available && (next(length) >> 12u) == 0x6)
+			{
+				++length;
+			}
+
+			if (length > 1)
+			{
+				handler = &FUSE_6XKK_RUN;
+			}
+			break;
+		case 0xA:
+			//point I at a sprite and draw it
+			if (available > 1 && (next(1) >> 12u) == 0xD)
+			{
+				length = 2;
+				handler = &FUSE_ANNN_DXYN;
+			}
+			break;
+		case 0x7:
+			//bump a counter and test it
+			if (available > 1 && (next(1) >> 12u) == 0x3)
+			{
+				length = 2;
+				handler = &FUSE_7XKK_3XKK;
+			}
+			else if (available > 1 && (next(1) >> 12u) == 0x4)
+			{
+				length = 2;
+				handler = &FUSE_7XKK_4XKK;
+			}
+			break;
+		case 0xF:
+			//LD Vx, DT / SE Vx, 0 / JP back: waiting for the delay timer to run out
+			if ((op.opcode & 0x00FFu) == 0x07 && available > 2
+				&& next(1) == (0x3000u | (op.x << 8u)) && (next(2) >> 12u) == 0x1)
+			{
+				length = 3;
+				handler = &FUSE_FX07_3X00_1NNN;
+			}
+			break;
+	}
+
+	if (handler == nullptr)
+	{
+		return false;
+	}
+
+	//the following entries are decoded without fusing, this keeps Decode from
+	//recursing down a long row of instructions
+	for (unsigned int i = 1; i < length; ++i)
+	{
+		DecodedOp& follower = (&op)[2 * i];
+		if (follower.handler == nullptr)
+		{
+			Decode(address + 2 * i, follower, false);
+		}
+	}
+
+	op.handler = handler;
+	op.length = (uint8_t)length;
+	return true;
+}
+
+/*
+Forget all decoded instructions and recompiled blocks that read any byte
+from first to last. an instruction is two bytes, so the decoded entry one
+before first goes too (and a few more for superinstructions).
+
+Parameters:
+first = first address that was written
+last = last address that was written
+*/
+void Chip8::InvalidateCode(unsigned int first, unsigned int last)
+{
+	if (first <= idleLast && last >= idleFirst)
+	{
+		ForgetIdle();
+	}
+
+#if CHIP8_HAS_JIT
+	if (jit)
+	{
+		jit->Invalidate(first, last);
+	}
+#endif
+
+	if (!decoded || last < START_ADDRESS)
+	{
+		return;
+	}
+
+	//a superinstruction reads up to MAX_FUSED_LENGTH instructions, so its entry
+	//can be up to 2 * MAX_FUSED_LENGTH - 1 bytes in front of the first written byte
+	unsigned int reach = 2 * MAX_FUSED_LENGTH - 1;
+	unsigned int begin = first > START_ADDRESS + reach ? first - reach : START_ADDRESS;
+	unsigned int end = last < MEMORY_SIZE - 1 ? last : MEMORY_SIZE - 1;
+
+	for (unsigned int address = begin; address <= end; ++address)
+	{
+		decoded[address - START_ADDRESS].handler = nullptr;
+	}
+}
+
+//same bits as FlatEntry, but the simple instructions get their decoded versions
+Chip8::DecodedFunc Chip8::DecodedEntry(uint16_t op)
+{
+	switch (op >> 12u)
+	{
+		case 0x0:
+			switch (op & 0x000Fu)
+			{
+				case 0x0: return &DecodedCall<&Chip8::OP_00E0>;
+				case 0xE: return &DEC_00EE;
+			}
+			break;
+		case 0x1: return &DEC_1NNN;
+		case 0x2: return &DEC_2NNN;
+		case 0x3: return &DEC_3XKK;
+		case 0x4: return &DEC_4XKK;
+		case 0x5: return &DEC_5XY0;
+		case 0x6: return &DEC_6XKK;
+		case 0x7: return &DEC_7XKK;
+		case 0x8:
+			switch (op & 0x000Fu)
+			{
+				case 0x0: return &DEC_8XY0;
+				case 0x1: return &DEC_8XY1;
+				case 0x2: return &DEC_8XY2;
+				case 0x3: return &DEC_8XY3;
+				case 0x4: return &DecodedCall<&Chip8::OP_8XY4>;
+				case 0x5: return &DecodedCall<&Chip8::OP_8XY5>;
+				case 0x6: return &DecodedCall<&Chip8::OP_8XY6>;
+				case 0x7: return &DecodedCall<&Chip8::OP_8XY7>;
+				case 0xE: return &DecodedCall<&Chip8::OP_8XYE>;
+			}
+			break;
+		case 0x9: return &DEC_9XY0;
+		case 0xA: return &DEC_ANNN;
+		case 0xB: return &DecodedCall<&Chip8::OP_BNNN>;
+		case 0xC: return &DecodedCall<&Chip8::OP_CXKK>;
+		case 0xD: return &DecodedCall<&Chip8::OP_DXYN>;
+		case 0xE:
+			switch (op & 0x000Fu)
+			{
+				case 0x1: return &DecodedCall<&Chip8::OP_EXA1>;
+				case 0xE: return &DecodedCall<&Chip8::OP_EX9E>;
+			}
+			break;
+		case 0xF:
+			switch (op & 0x00FFu)
+			{
+				case 0x07: return &DEC_FX07;
+				case 0x0A: return &DecodedCall<&Chip8::OP_FX0A>;
+				case 0x15: return &DecodedCall<&Chip8::OP_FX15>;
+				case 0x18: return &DecodedCall<&Chip8::OP_FX18>;
+				case 0x1E: return &DEC_FX1E;
+				case 0x29: return &DecodedCall<&Chip8::OP_FX29>;
+				case 0x33: return &DecodedCall<&Chip8::OP_FX33>;
+				case 0x55: return &DecodedCall<&Chip8::OP_FX55>;
+				case 0x65: return &DecodedCall<&Chip8::OP_FX65>;
+			}
+			break;
+	}
+
+	return &DecodedCall<&Chip8::OP_NULL>;
+}
+
+//these do exactly what their OP_* handlers do
+void Chip8::DEC_00EE(Chip8& chip, DecodedOp const&)
+{
+	chip.sp--;
+	chip.pc = chip.stack[chip.sp];
+}
+
+void Chip8::DEC_1NNN(Chip8& chip, DecodedOp const& op)
+{
+	chip.pc = op.nnn;
+}
+
+void Chip8::DEC_2NNN(Chip8& chip, DecodedOp const& op)
+{
+	chip.stack[chip.sp] = chip.pc;
+	chip.sp++;
+	chip.pc = op.nnn;
+}
+
+void Chip8::DEC_3XKK(Chip8& chip, DecodedOp const& op)
+{
+	if (chip.registers[op.x] == op.kk)
+	{
+		chip.pc += 2;
+	}
+}
+
+void Chip8::DEC_4XKK(Chip8& chip, DecodedOp const& op)
+{
+	if (chip.registers[op.x] != op.kk)
+	{
+		chip.pc += 2;
+	}
+}
+
+void Chip8::DEC_5XY0(Chip8& chip, DecodedOp const& op)
+{
+	if (chip.registers[op.x] == chip.registers[op.y])
+	{
+		chip.pc += 2;
+	}
+}
+
+void Chip8::DEC_6XKK(Chip8& chip, DecodedOp const& op)
+{
+	chip.registers[op.x] = op.kk;
+}
+
+void Chip8::DEC_7XKK(Chip8& chip, DecodedOp const& op)
+{
+	chip.registers[op.x] += op.kk;
+}
+
+void Chip8::DEC_8XY0(Chip8& chip, DecodedOp const& op)
+{
+	chip.registers[op.x] = chip.registers[op.y];
+}
+
+void Chip8::DEC_8XY1(Chip8& chip, DecodedOp const& op)
+{
+	chip.registers[op.x] |= chip.registers[op.y];
+}
+
+void Chip8::DEC_8XY2(Chip8& chip, DecodedOp const& op)
+{
+	chip.registers[op.x] &= chip.registers[op.y];
+}
+
+void Chip8::DEC_8XY3(Chip8& chip, DecodedOp const& op)
+{
+	chip.registers[op.x] ^= chip.registers[op.y];
+}
+
+void Chip8::DEC_9XY0(Chip8& chip, DecodedOp const& op)
+{
+	if (chip.registers[op.x] != chip.registers[op.y])
+	{
+		chip.pc += 2;
+	}
+}
+
+void Chip8::DEC_ANNN(Chip8& chip, DecodedOp const& op)
+{
+	chip.index = op.nnn;
+}
+
+void Chip8::DEC_FX07(Chip8& chip, DecodedOp const& op)
+{
+	chip.registers[op.x] = chip.delay;
+}
+
+void Chip8::DEC_FX1E(Chip8& chip, DecodedOp const& op)
+{
+	chip.index += chip.registers[op.x];
+}
+
+/***************************************************
+*  Superinstructions                               *
+*                                                  *
+*  Each one does exactly what the instructions it  *
+*  replaces would do one after another. pc was     *
+*  already moved past the first instruction.       *
+***************************************************/
+
+void Chip8::FUSE_6XKK_RUN(Chip8& chip, DecodedOp const& op)
+{
+	DecodedOp const* ops = &op;
+
+	chip.registers[op.x] = op.kk;
+
+	for (unsigned int i = 1; i < op.length; ++i)
+	{
+		chip.registers[ops[2 * i].x] = ops[2 * i].kk;
+		chip.pc += 2;
+	}
+}
+
+void Chip8::FUSE_ANNN_DXYN(Chip8& chip, DecodedOp const& op)
+{
+	chip.index = op.nnn;
+
+	chip.pc += 2;
+	chip.opcode = (&op)[2].opcode;
+	chip.OP_DXYN();
+}
+
+void Chip8::FUSE_7XKK_3XKK(Chip8& chip, DecodedOp const& op)
+{
+	DecodedOp const& test = (&op)[2];
+
+	chip.registers[op.x] += op.kk;
+
+	chip.pc += 2;
+	if (chip.registers[test.x] == test.kk)
+	{
+		chip.pc += 2;
+	}
+}
+
+void Chip8::FUSE_7XKK_4XKK(Chip8& chip, DecodedOp const& op)
+{
+	DecodedOp const& test = (&op)[2];
+
+	chip.registers[op.x] += op.kk;
+
+	chip.pc += 2;
+	if (chip.registers[test.x] != test.kk)
+	{
+		chip.pc += 2;
+	}
+}
+
+//once the timer is 0 the SE skips the jump, so only two instructions run
+void Chip8::FUSE_FX07_3X00_1NNN(Chip8& chip, DecodedOp const& op)
+{
+	chip.registers[op.x] = chip.delay;
+
+	chip.pc += 2;
+	if (chip.registers[op.x] == 0)
+	{
+		chip.pc += 2;
+		chip.fusedSkipped = 1;
+		return;
+	}
+
+	chip.pc = (&op)[4].nnn;
+}
@@ -11,8 +11,12 @@
 
 #pragma once
 
+#include <array>
+#include <bitset>
+#include <cstddef>
 #include <cstdint>
-#include <random>
+#include <memory>
+#include "Profile.hpp"
 
 
 const unsigned int KEY_COUNT = 16;
@@ -21,20 +25,200 @@ const unsigned int REGISTER_COUNT = 16;
 const unsigned int STACK_LEVELS = 16;
 const unsigned int VIDEO_HEIGHT = 32;
 const unsigned int VIDEO_WIDTH = 64;
+static_assert(VIDEO_WIDTH == 64, "a row of the screen is one uint64_t");
 
+//where ROMs get loaded and where pc starts
+const unsigned int START_ADDRESS = 0x200;
+
+//which interpreter core Run() uses. they all run the same OP_* handlers,
+//they only differ in how they get from an opcode to its handler.
+enum class Dispatch
+{
+	Table,	//table of member function pointers (what Cycle() does)
+	Switch,	//one big switch on the opcode
+	Goto,	//computed goto threaded loop (GCC/Clang, falls back to Switch)
+	Flat,	//one 65536 entry table indexed by the whole opcode
+	Decoded,	//pre-decoded program area, no fetch or decode for code that was already seen
+	Fused,	//Decoded, plus common instruction sequences run as one superinstruction
+	Jit,	//basic blocks recompiled to x86-64 (see Jit.hpp), Decoded on other CPUs
+};
+
+//what a machine was doing at the start of the last Run
+enum class IdleState
+{
+	Running,	//real work, or at least nothing that repeats itself
+	WaitTimer,	//spinning until the delay timer changes (FX07 polling loops)
+	WaitKey,	//spinning until the keys change (FX0A, or EX9E/EXA1 polling)
+	Halted,	//spinning where nothing can get it out (like 1NNN jumping to itself)
+};
+
+//everything that makes up a running machine (the caches of the faster cores
+//are not part of it, they get rebuilt). plain data, so taking a snapshot is
+//one copy of about 4.5 KB and can be done every frame.
+//Savestate.hpp turns it into a versioned file
+struct Chip8State
+{
+	uint8_t memory[MEMORY_SIZE];
+	uint8_t registers[REGISTER_COUNT];
+	uint16_t index;
+	uint16_t pc;
+	uint16_t stack[STACK_LEVELS];
+	uint8_t sp;
+	uint8_t delay;
+	uint8_t sound;
+	uint8_t keypad[KEY_COUNT];
+	uint64_t video[VIDEO_HEIGHT];
+	uint64_t randomKey;
+	uint64_t randomCounter;
+};
+
+class Chip8Jit;
 
 class Chip8
 {
+	//the recompilers read and write the machine state directly
+	friend class Chip8Jit;
+	friend class Chip8Recompiled;
+	//the benchmarks time the handlers one by one
+	friend class Chip8Bench;
+
 public:
+	//memory laid out the way LoadROM leaves it (font and program) that any
+	//number of machines can load without copying it: LoadImage makes a machine
+	//share it until the machine writes to memory, the same as a Fork.
+	//LoadROM on a fresh machine does this by itself, so all the machines that
+	//run one ROM share its 4 KB until they write (FX33/FX55) to it.
+	//RomLibrary keeps one of these per ROM
+	struct Image
+	{
+		std::shared_ptr<uint8_t[]> memory;
+		uint64_t memoryHash{};	//see StateHash.hpp
+	};
+	//false if the ROM doesnt fit in memory
+	static bool MakeImage(uint8_t const* data, size_t size, Image& image);
+	//the memory this machine has right now, for other machines to LoadImage
+	Image MemoryImage() const { return Image{ memoryBlock, memoryHash }; }
+
 	Chip8();
-	void LoadROM(char const* filename);
+	//instances with the same seed and different streams get
+	//independent random numbers (see Random.hpp)
+	explicit Chip8(uint64_t seed, uint64_t stream = 0);
+	bool LoadROM(char const* filename);
+	bool LoadROM(uint8_t const* data, size_t size);
+	//the same as LoadROM with the ROM image was made from, without copying anything
+	void LoadImage(Image const& image);
 	void Cycle();
 	~Chip8();
 
+	//run a number of cycles with the selected interpreter core.
+	//returns the number of cycles that were run.
+	//a machine that starts the run in an idle loop (a few instructions that
+	//come back to where they started without changing anything: a jump to
+	//itself, FX0A with no key down, polling the delay timer or the keys) can
+	//only leave it when the timers tick or the keys change, which never
+	//happens inside a run. so the loop is fast-forwarded to the end of the
+	//cycles, with exactly the result running them would have given
+	uint64_t Run(uint64_t cycles);
+	//fast-forwarding is on by default, switch it off to time the cores
+	void SetIdleSkip(bool on) { idleSkip = on; }
+	IdleState GetIdle() const { return idle; }
+	void SetDispatch(Dispatch mode);
+	Dispatch GetDispatch() const { return dispatch; }
+
+	//the delay and sound timers count down at 60 Hz, independent of how many
+	//instructions run. whoever drives the emulator calls this once per frame
+	void TickTimers();
+
+	//read only views of the machine so tools (like the headless runner)
+	//can dump the state without poking around in the private parts
+	uint8_t const* GetRegisters() const { return registers; }
+	uint16_t const* GetStack() const { return stack; }
+	uint16_t GetIndex() const { return index; }
+	uint16_t GetPC() const { return pc; }
+	uint8_t GetSP() const { return sp; }
+	uint8_t GetDelay() const { return delay; }
+	uint8_t GetSound() const { return sound; }
+	uint8_t const* GetMemory() const { return memory; }
+
 	uint8_t keypad[KEY_COUNT]{};
-	uint32_t video[VIDEO_WIDTH * VIDEO_HEIGHT]{};
+
+	//the screen is 1 bit per pixel, one uint64_t per row with the
+	//left most pixel in the top bit. use ExpandVideo to get RGBA pixels
+	uint64_t video[VIDEO_HEIGHT]{};
+	void ExpandVideo(uint32_t* pixels) const;
+
+	//in memory snapshots. LoadState only throws away decoded/recompiled code
+	//for the part of memory that is actually different
+	void SaveState(Chip8State& state) const;
+	void LoadState(Chip8State const& state);
+
+	//a new machine in exactly this state, to try out what happens next without
+	//touching this one. the two share their memory until either of them writes
+	//to it, so a fork only copies the registers, stack, keys and screen (about
+	//400 bytes). the fork gets its own random numbers (stream picks which, the
+	//same stream always gives the same numbers), the same Dispatch and no
+	//decoded/recompiled code yet, so short branches are cheapest on the
+	//Switch or Goto cores
+	std::unique_ptr<Chip8> Fork(uint64_t stream) const;
+	//the same, into a machine that already exists (saves the allocation).
+	//its decoded/recompiled code stays valid where the memory is the same
+	void ForkInto(Chip8& into, uint64_t stream) const;
+
+	//hash of everything that decides what the machine does next: memory,
+	//screen, registers, I, pc, the live part of the stack, the timers and the
+	//random numbers (not the keys, they are input). memory and the screen are
+	//kept hashed as they change (see StateHash.hpp), so this only hashes
+	//about 60 bytes. equal states give equal hashes on every Dispatch
+	uint64_t StateHash() const;
+	//the same value worked out from scratch, for checking the incremental one
+	uint64_t ComputeStateHash() const;
+
+#if CHIP8_PROFILE
+	//what Cycle() counted so far. Clear() it to start a new measurement
+	Chip8Profile& GetProfile() { return profile; }
+#endif
 
 private:
+	//the memory every new machine starts out sharing, just the font
+	static Image const& PowerOnImage();
+	//the memory of a fresh machine after LoadROM(data, size). machines (and
+	//RomLibrary) that load the same ROM get the same block
+	static Image SharedImage(uint8_t const* data, size_t size);
+
+	//the private constructor Fork uses
+	Chip8(Chip8 const& parent, uint64_t stream);
+	void CopyForkState(Chip8 const& parent, uint64_t stream);
+
+	//call before writing to memory. only a block this machine copied itself is
+	//written in place, anything else (a shared ROM image, a fork's parent, the
+	//power on image) may be used by others and gets copied first
+	void WritableMemory()
+	{
+		if (!privateMemory || memoryBlock.use_count() > 1)
+		{
+			CopyMemory();
+		}
+	}
+	void CopyMemory();
+	//update memoryHash for bytes first.. of memory becoming bytes, before they are copied in
+	void HashMemoryWrite(unsigned int first, uint8_t const* bytes, size_t count);
+	uint64_t HashCpu() const;
+	//start using block as memory, invalidating code only where it differs
+	void ShareMemory(std::shared_ptr<uint8_t[]> const& block);
+
+	uint64_t SkipIdle(uint64_t cycles);
+	//remember that there is no idle loop at start (the code from low to high was
+	//run to find that out), returns done
+	uint64_t NotIdle(uint16_t start, uint16_t low, uint16_t high, bool readsInput, uint64_t done);
+	void ForgetIdle();
+
+	void RunTable(uint64_t cycles);
+	void RunSwitch(uint64_t cycles);
+	void RunGoto(uint64_t cycles);
+	void RunFlat(uint64_t cycles);
+	void RunDecoded(uint64_t cycles);
+	void RunJit(uint64_t cycles);
+
 	void Table0();
 	void Table8();
 	void TableE();
@@ -84,9 +268,20 @@ private:
 	//FINAL FIX...HOPEFULLY!
 	//For some reason (at least for me), having registers being initialized before memory causes my emulation to
 	//run buggy. swapping it so that memory is before registers fixes the issue. dont know why that is
+	//(an I or pc at the very end of memory reads past it, into whatever comes next.
+	//memory is now its own block with MEMORY_PADDING spare bytes at the end for that)
 	/*uint8_t registers[REGISTER_COUNT]{};
 	uint8_t memory[MEMORY_SIZE]{};*/
-	uint8_t memory[MEMORY_SIZE]{};
+	//memory points at memoryBlock, which forks (and machines that loaded the
+	//same ROM) share until one of them writes. reads just use memory[], writes
+	//call WritableMemory() first. it is copied as a whole and not in smaller
+	//pages, so every core keeps reading memory without a page table in between
+	static const unsigned int MEMORY_PADDING = 16;
+	uint8_t* memory{};
+	std::shared_ptr<uint8_t[]> memoryBlock;
+	//set by CopyMemory only. the table of SharedImage holds its blocks through
+	//weak_ptrs, so use_count() alone cant tell that a block is still shared
+	bool privateMemory{};
 	uint8_t registers[REGISTER_COUNT]{};
 	uint16_t index{};
 	uint16_t pc{};
@@ -96,11 +291,13 @@ private:
 	uint8_t sp{};
 	uint16_t opcode{};
 
-	//hover over default_random_engine and you see the keyword "using"
-	//so from what i understand, we are taking and using this from the
-	//std class. maybe thats why we need to initialize at the beginning of constructor
-	std::default_random_engine randomSeed;
-	std::uniform_int_distribution<short> randomByte;
+	//CXKK takes random number randomCounter of the stream randomKey picks
+	uint64_t randomKey{};
+	uint64_t randomCounter{};
+
+	//Zobrist hashes of memory and video, updated by every write to them
+	uint64_t memoryHash{};
+	uint64_t videoHash{};
 
 	//typedef void () defines a pointer to function type;
 	//in our case, this type is called Chip8Func
@@ -108,11 +305,101 @@ private:
 	//create function arrays that return a pointer to a function
 	//instantiate all the contents of the array to point to the 
 	//OP_NULL function
-	//in the Chip8 Constructor we set the indexes we need to point
+	//in Chip8.cpp we set the indexes we need to point
 	//to the corresponding function
-	Chip8Func table[0xF + 1]{ &Chip8::OP_NULL };
-	Chip8Func table0[0xE + 1]{ &Chip8::OP_NULL };
-	Chip8Func table8[0xE + 1]{ &Chip8::OP_NULL };
-	Chip8Func tableE[0xE + 1]{ &Chip8::OP_NULL };
-	Chip8Func tableF[0x65 + 1]{ &Chip8::OP_NULL };
+	//FIX: the sub tables are indexed with a whole nibble (or a whole byte for tableF),
+	//so they need 16 (256) entries. everything that isnt set points to OP_NULL.
+	//the tables are the same for every instance, so they are static and built
+	//by the compiler (see Chip8.cpp) instead of 5 KB of copies in each one
+	static const std::array<Chip8Func, 0xF + 1> table;
+	static const std::array<Chip8Func, 0xF + 1> table0;
+	static const std::array<Chip8Func, 0xF + 1> table8;
+	static const std::array<Chip8Func, 0xF + 1> tableE;
+	static const std::array<Chip8Func, 0xFF + 1> tableF;
+
+	//the flat core skips the member function pointers and calls plain functions.
+	//Call<&Chip8::OP_XXXX> is a tiny wrapper the compiler can inline the handler into.
+	//flatTable has one entry for every possible opcode and is built at compile time
+	typedef void (*FlatFunc)(Chip8&);
+	template <void (Chip8::* Handler)()>
+	static void Call(Chip8& chip) { (chip.*Handler)(); }
+	static constexpr FlatFunc FlatEntry(uint16_t op);
+	static constexpr std::array<FlatFunc, 0x10000> MakeFlatTable();
+	static const std::array<FlatFunc, 0x10000> flatTable;
+
+	//the decoded core keeps one entry per address of the program area
+	//(START_ADDRESS and up), filled the first time that address is executed.
+	//the handler gets the operands already pulled out of the opcode.
+	//anything that writes to memory has to call InvalidateCode so
+	//self modifying ROMs still see their new code.
+	struct DecodedOp;
+	typedef void (*DecodedFunc)(Chip8&, DecodedOp const&);
+	struct DecodedOp
+	{
+		DecodedFunc handler;	//nullptr = not decoded yet
+		uint16_t opcode;
+		uint16_t nnn;
+		uint8_t x;
+		uint8_t y;
+		uint8_t kk;
+		uint8_t n;
+		uint8_t length;	//instructions this entry runs, more than 1 for a fused sequence
+	};
+	template <void (Chip8::* Handler)()>
+	static void DecodedCall(Chip8& chip, DecodedOp const& op) { chip.opcode = op.opcode; (chip.*Handler)(); }
+	static DecodedFunc DecodedEntry(uint16_t op);
+	void Decode(uint16_t address, DecodedOp& op, bool fuse);
+	bool Fuse(uint16_t address, DecodedOp& op);
+	void InvalidateCode(unsigned int first, unsigned int last);
+
+	//decoded versions of the simple (and most common) instructions.
+	//everything else goes through DecodedCall and the normal OP_* handler
+	static void DEC_00EE(Chip8& chip, DecodedOp const& op);
+	static void DEC_1NNN(Chip8& chip, DecodedOp const& op);
+	static void DEC_2NNN(Chip8& chip, DecodedOp const& op);
+	static void DEC_3XKK(Chip8& chip, DecodedOp const& op);
+	static void DEC_4XKK(Chip8& chip, DecodedOp const& op);
+	static void DEC_5XY0(Chip8& chip, DecodedOp const& op);
+	static void DEC_6XKK(Chip8& chip, DecodedOp const& op);
+	static void DEC_7XKK(Chip8& chip, DecodedOp const& op);
+	static void DEC_8XY0(Chip8& chip, DecodedOp const& op);
+	static void DEC_8XY1(Chip8& chip, DecodedOp const& op);
+	static void DEC_8XY2(Chip8& chip, DecodedOp const& op);
+	static void DEC_8XY3(Chip8& chip, DecodedOp const& op);
+	static void DEC_9XY0(Chip8& chip, DecodedOp const& op);
+	static void DEC_ANNN(Chip8& chip, DecodedOp const& op);
+	static void DEC_FX07(Chip8& chip, DecodedOp const& op);
+	static void DEC_FX1E(Chip8& chip, DecodedOp const& op);
+
+	//superinstructions for the Fused core. the entries of the instructions
+	//after the first one are at (&op)[2], (&op)[4], ...
+	static void FUSE_6XKK_RUN(Chip8& chip, DecodedOp const& op);	//6XKK 6XKK ...
+	static void FUSE_ANNN_DXYN(Chip8& chip, DecodedOp const& op);	//ANNN DXYN
+	static void FUSE_7XKK_3XKK(Chip8& chip, DecodedOp const& op);	//7XKK 3XKK (counted loop)
+	static void FUSE_7XKK_4XKK(Chip8& chip, DecodedOp const& op);	//7XKK 4XKK (counted loop)
+	static void FUSE_FX07_3X00_1NNN(Chip8& chip, DecodedOp const& op);	//FX07 3X00 1NNN (wait for the delay timer)
+
+	//allocated the first time the decoded core runs, so the other cores dont pay for it
+	std::unique_ptr<DecodedOp[]> decoded;
+	uint8_t fusedSkipped{};	//set by a superinstruction that left early, how many instructions it did not run
+
+	//created the first time the Jit core runs
+	std::unique_ptr<Chip8Jit> jit;
+
+	Dispatch dispatch{ Dispatch::Table };
+	bool idleSkip{ true };
+	IdleState idle{ IdleState::Running };
+	//the pcs where SkipIdle found no idle loop, so short runs dont pay for the
+	//check at the start of every one. only loops that read neither the keys nor
+	//the delay timer get in (the ones that do can go idle the next frame). all
+	//of them are forgotten when InvalidateCode hits idleFirst..idleLast (the
+	//code they ran) or a run is longer than idleCycles
+	std::bitset<MEMORY_SIZE> idleFailed;
+	unsigned int idleFirst{ MEMORY_SIZE };
+	unsigned int idleLast{};
+	uint64_t idleCycles{};
+
+#if CHIP8_PROFILE
+	Chip8Profile profile;
+#endif
 };
@@ -0,0 +1,684 @@
+#include "Jit.hpp"
+
+#if CHIP8_HAS_JIT
+
+#include <cstring>
+
+#if defined(_WIN32)
+#include "windows.h"
+#else
+#include <sys/mman.h>
+#endif
+
+//host registers, numbered the way x86 encodes them
+const int RAX = 0;
+const int RCX = 1;
+const int RDX = 2;
+const int RBP = 5;
+const int R12 = 12;
+const int R13 = 13;
+const int R14 = 14;
+const int R15 = 15;
+
+//registers we can keep V registers in. they are callee saved,
+//so the OP_* handlers we call back into leave them alone
+const int CACHE_REGISTERS[] = { R12, R14, R15, RBP };
+const unsigned int CACHE_REGISTER_COUNT = 4;
+
+//condition codes for cmovcc
+const uint8_t CC_E = 0x4;
+const uint8_t CC_NE = 0x5;
+
+const unsigned int MAX_BLOCK_LENGTH = 64;
+const size_t MAX_BLOCK_BYTES = 16 * 1024;
+const size_t CODE_SIZE = 512 * 1024;
+
+//offset of a member inside a Chip8 object. offsetof isnt allowed on Chip8
+//(it has private members), so just measure it
+template <typename T>
+int32_t OffsetOf(Chip8 const& chip, T const* member)
+{
+	return (int32_t)(reinterpret_cast<uint8_t const*>(member) - reinterpret_cast<uint8_t const*>(&chip));
+}
+
+//does this instruction end a block?
+bool IsTerminator(uint16_t op)
+{
+	switch (op >> 12u)
+	{
+		case 0x0: return (op & 0x000Fu) == 0xE;	//00EE
+		case 0x1:
+		case 0x2:
+		case 0x3:
+		case 0x4:
+		case 0x5:
+		case 0x9:
+		case 0xB:
+		case 0xD:
+		case 0xE:
+			return true;
+		case 0xF:
+			switch (op & 0x00FFu)
+			{
+				case 0x0A:
+				case 0x33:
+				case 0x55:
+					return true;
+			}
+			return false;
+	}
+
+	return false;
+}
+
+Chip8Jit::Chip8Jit(Chip8& chip) : chip(chip)
+{
+	offRegisters = OffsetOf(chip, chip.registers);
+	offIndex = OffsetOf(chip, &chip.index);
+	offPc = OffsetOf(chip, &chip.pc);
+	offDelay = OffsetOf(chip, &chip.delay);
+	offSound = OffsetOf(chip, &chip.sound);
+	offStack = OffsetOf(chip, chip.stack);
+	offSp = OffsetOf(chip, &chip.sp);
+
+	//the code buffer is never writable and executable at the same time,
+	//Compile flips it to writable while it emits a block
+#if defined(_WIN32)
+	code = static_cast<uint8_t*>(VirtualAlloc(nullptr, CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+#else
+	void* memory = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	code = memory == MAP_FAILED ? nullptr : static_cast<uint8_t*>(memory);
+#endif
+
+	codeSize = code ? CODE_SIZE : 0;
+}
+
+Chip8Jit::~Chip8Jit()
+{
+	if (code)
+	{
+#if defined(_WIN32)
+		VirtualFree(code, 0, MEM_RELEASE);
+#else
+		munmap(code, codeSize);
+#endif
+	}
+}
+
+void Chip8Jit::Run(uint64_t cycles)
+{
+	uint64_t done = 0;
+
+	while (done < cycles)
+	{
+		uint16_t pc = chip.pc;
+
+		if (pc < MEMORY_SIZE - 1)
+		{
+			Block& block = blocks[pc];
+
+			if (block.code == nullptr)
+			{
+				Compile(pc);
+			}
+
+			//a block always runs to its end, so near the end of the budget
+			//we go one instruction at a time to stop exactly at "cycles"
+			if (block.code != nullptr && block.length <= cycles - done)
+			{
+				//the block can flush the cache while it runs (self modifying code),
+				//so grab the length before running it
+				uint16_t length = block.length;
+				block.code(&chip);
+				done += length;
+				continue;
+			}
+		}
+
+		InterpretOne();
+		++done;
+	}
+}
+
+void Chip8Jit::InterpretOne()
+{
+	chip.opcode = (chip.memory[chip.pc] << 8u) | chip.memory[chip.pc + 1];
+	chip.pc += 2;
+	Chip8::flatTable[chip.opcode](chip);
+}
+
+void Chip8Jit::Invalidate(unsigned int first, unsigned int last)
+{
+	if (last >= MEMORY_SIZE)
+	{
+		last = MEMORY_SIZE - 1;
+	}
+
+	//self modifying code is rare enough that throwing everything away is fine.
+	//this can run from inside a block (FX55 calls back into the handler), which
+	//is ok because the old code stays in the buffer until the next Compile
+	for (unsigned int address = first; address <= last; ++address)
+	{
+		if (covered[address])
+		{
+			Flush();
+			return;
+		}
+	}
+}
+
+void Chip8Jit::Flush()
+{
+	std::memset(blocks, 0, sizeof(blocks));
+	std::memset(covered, 0, sizeof(covered));
+	codeUsed = 0;
+}
+
+//called from inside a block to run one instruction with the normal handler.
+//the block has already moved pc past the instruction
+void Chip8Jit::Interpret(Chip8* chip, uint32_t opcode)
+{
+	chip->opcode = (uint16_t)opcode;
+	Chip8::flatTable[opcode](*chip);
+}
+
+bool Chip8Jit::Compile(uint16_t address)
+{
+	if (code == nullptr)
+	{
+		return false;
+	}
+
+	if (codeSize - codeUsed < MAX_BLOCK_BYTES)
+	{
+		Flush();
+	}
+
+	//find the end of the block first, so we know which V registers are worth caching
+	unsigned int length = 0;
+	bool terminated = false;
+	while (length < MAX_BLOCK_LENGTH && address + 2 * length < MEMORY_SIZE - 1)
+	{
+		uint16_t at = address + 2 * length;
+		uint16_t op = (chip.memory[at] << 8u) | chip.memory[at + 1];
+		++length;
+
+		if (IsTerminator(op))
+		{
+			terminated = true;
+			break;
+		}
+	}
+
+	if (length == 0)
+	{
+		return false;
+	}
+
+	unsigned int uses[REGISTER_COUNT]{};
+	CountRegisterUses(address, length, uses);
+
+	for (int& host : cache)
+	{
+		host = -1;
+	}
+
+	for (unsigned int slot = 0; slot < CACHE_REGISTER_COUNT; ++slot)
+	{
+		unsigned int best = 0;
+		for (unsigned int v = 1; v < REGISTER_COUNT; ++v)
+		{
+			if (uses[v] > uses[best])
+			{
+				best = v;
+			}
+		}
+
+		//loading and spilling costs two moves, not worth it for a single use
+		if (uses[best] < 2)
+		{
+			break;
+		}
+
+		cache[best] = CACHE_REGISTERS[slot];
+		uses[best] = 0;
+	}
+
+#if defined(_WIN32)
+	DWORD oldProtect;
+	VirtualProtect(code, codeSize, PAGE_READWRITE, &oldProtect);
+#else
+	mprotect(code, codeSize, PROT_READ | PROT_WRITE);
+#endif
+
+	uint8_t* start = code + codeUsed;
+
+	Prologue();
+
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		uint16_t at = address + 2 * i;
+		uint16_t op = (chip.memory[at] << 8u) | chip.memory[at + 1];
+		CompileInstruction(at, op);
+		covered[at] = 1;
+		covered[at + 1] = 1;
+	}
+
+	//ran out of room (or memory) before a terminator, carry on after the block
+	if (!terminated)
+	{
+		StorePC(address + 2 * length);
+	}
+
+	SpillCache();
+	StoreIndex();
+	Epilogue();
+
+#if defined(_WIN32)
+	VirtualProtect(code, codeSize, PAGE_EXECUTE_READ, &oldProtect);
+	FlushInstructionCache(GetCurrentProcess(), start, code + codeUsed - start);
+#else
+	mprotect(code, codeSize, PROT_READ | PROT_EXEC);
+#endif
+
+	blocks[address].code = reinterpret_cast<BlockFunc>(start);
+	blocks[address].length = (uint16_t)length;
+
+	return true;
+}
+
+void Chip8Jit::CountRegisterUses(uint16_t address, unsigned int length, unsigned int uses[REGISTER_COUNT])
+{
+	for (unsigned int i = 0; i < length; ++i)
+	{
+		uint16_t at = address + 2 * i;
+		uint16_t op = (chip.memory[at] << 8u) | chip.memory[at + 1];
+		unsigned int x = (op & 0x0F00u) >> 8u;
+		unsigned int y = (op & 0x00F0u) >> 4u;
+
+		switch (op >> 12u)
+		{
+			case 0x3:
+			case 0x4:
+			case 0x6:
+			case 0x7:
+				uses[x]++;
+				break;
+			case 0x5:
+			case 0x9:
+				uses[x]++;
+				uses[y]++;
+				break;
+			case 0x8:
+				uses[x] += 2;
+				uses[y]++;
+				uses[0xF]++;
+				break;
+			case 0xF:
+				uses[x]++;
+				break;
+		}
+	}
+}
+
+/*
+Emit native code for one instruction
+
+Parameters:
+address = where the instruction is in CHIP-8 memory
+op = the opcode
+*/
+bool Chip8Jit::CompileInstruction(uint16_t address, uint16_t op)
+{
+	unsigned int x = (op & 0x0F00u) >> 8u;
+	unsigned int y = (op & 0x00F0u) >> 4u;
+	uint8_t kk = op & 0x00FFu;
+	uint16_t nnn = op & 0x0FFFu;
+	bool native = true;
+
+	switch (op >> 12u)
+	{
+		case 0x0:
+			switch (op & 0x000Fu)
+			{
+				case 0x0:
+					native = false;
+					break;
+				case 0xE:
+					//00EE: dec byte [sp] / movzx eax, byte [sp] / movzx eax, word [stack + rax*2] / mov [pc], ax
+					Emit(0xFE); EmitMem(1, offSp);
+					Emit(0x0F); Emit(0xB6); EmitMem(RAX, offSp);
+					Emit(0x0F); Emit(0xB7); Emit(0x84); Emit(0x43); Emit32(offStack);
+					Emit(0x66); Emit(0x89); EmitMem(RAX, offPc);
+					break;
+			}
+			break;
+		case 0x1:
+			StorePC(nnn);
+			break;
+		case 0x2:
+			//movzx eax, byte [sp] / mov word [stack + rax*2], return address / inc byte [sp]
+			Emit(0x0F); Emit(0xB6); EmitMem(RAX, offSp);
+			Emit(0x66); Emit(0xC7); Emit(0x84); Emit(0x43); Emit32(offStack); Emit16(address + 2);
+			Emit(0xFE); EmitMem(0, offSp);
+			StorePC(nnn);
+			break;
+		case 0x3:
+			LoadV(RAX, x);
+			Emit(0x3D); Emit32(kk);
+			Skip(address, CC_E);
+			break;
+		case 0x4:
+			LoadV(RAX, x);
+			Emit(0x3D); Emit32(kk);
+			Skip(address, CC_NE);
+			break;
+		case 0x5:
+			LoadV(RAX, x);
+			LoadV(RCX, y);
+			Emit(0x39); Emit(0xC8);
+			Skip(address, CC_E);
+			break;
+		case 0x6:
+			Emit(0xB8); Emit32(kk);
+			StoreV(x, RAX);
+			break;
+		case 0x7:
+			LoadV(RAX, x);
+			Emit(0x05); Emit32(kk);
+			StoreV(x, RAX);
+			break;
+		case 0x8:
+			//the loads and stores follow the OP_8XY* handlers line by line,
+			//so x or y being F gives the same result
+			switch (op & 0x000Fu)
+			{
+				case 0x0:
+					LoadV(RAX, y);
+					StoreV(x, RAX);
+					break;
+				case 0x1:
+				case 0x2:
+				case 0x3:
+				{
+					static const uint8_t aluOps[] = { 0x00, 0x09, 0x21, 0x31 };	//or, and, xor
+					LoadV(RAX, x);
+					LoadV(RCX, y);
+					Emit(aluOps[op & 0x000Fu]); Emit(0xC8);
+					StoreV(x, RAX);
+					break;
+				}
+				case 0x4:
+					LoadV(RAX, x);
+					LoadV(RCX, y);
+					Emit(0x01); Emit(0xC8);	//add eax, ecx
+					Emit(0x89); Emit(0xC2);	//mov edx, eax
+					Emit(0xC1); Emit(0xEA); Emit(0x08);	//shr edx, 8
+					StoreV(0xF, RDX);
+					StoreV(x, RAX);
+					break;
+				case 0x5:
+					LoadV(RAX, x);
+					LoadV(RCX, y);
+					Emit(0x39); Emit(0xC8);	//cmp eax, ecx
+					Emit(0x0F); Emit(0x97); Emit(0xC2);	//seta dl
+					StoreV(0xF, RDX);
+					LoadV(RAX, x);
+					LoadV(RCX, y);
+					Emit(0x29); Emit(0xC8);	//sub eax, ecx
+					StoreV(x, RAX);
+					break;
+				case 0x6:
+					LoadV(RAX, x);
+					Emit(0x83); Emit(0xE0); Emit(0x01);	//and eax, 1
+					StoreV(0xF, RAX);
+					LoadV(RAX, x);
+					Emit(0xD1); Emit(0xE8);	//shr eax, 1
+					StoreV(x, RAX);
+					break;
+				case 0x7:
+					LoadV(RAX, y);
+					LoadV(RCX, x);
+					Emit(0x39); Emit(0xC8);
+					Emit(0x0F); Emit(0x97); Emit(0xC2);
+					StoreV(0xF, RDX);
+					LoadV(RAX, y);
+					LoadV(RCX, x);
+					Emit(0x29); Emit(0xC8);
+					StoreV(x, RAX);
+					break;
+				case 0xE:
+					LoadV(RAX, x);
+					Emit(0xC1); Emit(0xE8); Emit(0x07);	//shr eax, 7
+					StoreV(0xF, RAX);
+					LoadV(RAX, x);
+					Emit(0xD1); Emit(0xE0);	//shl eax, 1
+					StoreV(x, RAX);
+					break;
+			}
+			break;
+		case 0x9:
+			LoadV(RAX, x);
+			LoadV(RCX, y);
+			Emit(0x39); Emit(0xC8);
+			Skip(address, CC_NE);
+			break;
+		case 0xA:
+			Emit(0x41); Emit(0xBD); Emit32(nnn);	//mov r13d, nnn
+			break;
+		case 0xB:
+			LoadV(RAX, 0);
+			Emit(0x05); Emit32(nnn);
+			Emit(0x66); Emit(0x89); EmitMem(RAX, offPc);
+			break;
+		case 0xF:
+			switch (op & 0x00FFu)
+			{
+				case 0x07:
+					Emit(0x0F); Emit(0xB6); EmitMem(RAX, offDelay);
+					StoreV(x, RAX);
+					break;
+				case 0x15:
+				case 0x18:
+					LoadV(RAX, x);
+					Emit(0x88); EmitMem(RAX, (op & 0x00FFu) == 0x15 ? offDelay : offSound);
+					break;
+				case 0x1E:
+					LoadV(RAX, x);
+					Emit(0x41); Emit(0x01); Emit(0xC5);	//add r13d, eax
+					Emit(0x41); Emit(0x81); Emit(0xE5); Emit32(0xFFFF);	//and r13d, 0xFFFF
+					break;
+				case 0x0A:
+				case 0x29:
+				case 0x33:
+				case 0x55:
+				case 0x65:
+					native = false;
+					break;
+			}
+			break;
+		default:
+			//CXKK, DXYN, EX9E, EXA1
+			native = false;
+			break;
+	}
+
+	if (!native)
+	{
+		CallInterpret(address, op);
+	}
+
+	return native;
+}
+
+void Chip8Jit::Emit(uint8_t byte)
+{
+	code[codeUsed++] = byte;
+}
+
+void Chip8Jit::Emit16(uint16_t value)
+{
+	Emit(value & 0xFFu);
+	Emit(value >> 8u);
+}
+
+void Chip8Jit::Emit32(uint32_t value)
+{
+	Emit16(value & 0xFFFFu);
+	Emit16(value >> 16u);
+}
+
+void Chip8Jit::Emit64(uint64_t value)
+{
+	Emit32(value & 0xFFFFFFFFu);
+	Emit32(value >> 32u);
+}
+
+//ModRM for [rbx + offset]. a REX prefix for reg >= 8 has to be emitted by the caller
+void Chip8Jit::EmitMem(int reg, int32_t offset)
+{
+	Emit(0x80 | ((reg & 7) << 3) | 3);
+	Emit32((uint32_t)offset);
+}
+
+//movzx hostReg, V[v]
+void Chip8Jit::LoadV(int hostReg, unsigned int v)
+{
+	int cached = cache[v];
+
+	if (cached >= 0)
+	{
+		Emit(0x40 | (cached >= 8 ? 1 : 0));
+		Emit(0x0F); Emit(0xB6); Emit(0xC0 | (hostReg << 3) | (cached & 7));
+	}
+	else
+	{
+		Emit(0x0F); Emit(0xB6); EmitMem(hostReg, offRegisters + v);
+	}
+}
+
+//mov V[v], low byte of hostReg
+void Chip8Jit::StoreV(unsigned int v, int hostReg)
+{
+	int cached = cache[v];
+
+	if (cached >= 0)
+	{
+		Emit(0x40 | (cached >= 8 ? 1 : 0));
+		Emit(0x88); Emit(0xC0 | (hostReg << 3) | (cached & 7));
+	}
+	else
+	{
+		Emit(0x88); EmitMem(hostReg, offRegisters + v);
+	}
+}
+
+void Chip8Jit::LoadCache()
+{
+	for (unsigned int v = 0; v < REGISTER_COUNT; ++v)
+	{
+		if (cache[v] >= 0)
+		{
+			Emit(0x40 | (cache[v] >= 8 ? 4 : 0));
+			Emit(0x8A); EmitMem(cache[v], offRegisters + v);
+		}
+	}
+}
+
+void Chip8Jit::SpillCache()
+{
+	for (unsigned int v = 0; v < REGISTER_COUNT; ++v)
+	{
+		if (cache[v] >= 0)
+		{
+			Emit(0x40 | (cache[v] >= 8 ? 4 : 0));
+			Emit(0x88); EmitMem(cache[v], offRegisters + v);
+		}
+	}
+}
+
+void Chip8Jit::LoadIndex()
+{
+	Emit(0x44); Emit(0x0F); Emit(0xB7); EmitMem(R13, offIndex);	//movzx r13d, word [index]
+}
+
+void Chip8Jit::StoreIndex()
+{
+	Emit(0x66); Emit(0x44); Emit(0x89); EmitMem(R13, offIndex);	//mov word [index], r13w
+}
+
+void Chip8Jit::StorePC(uint16_t value)
+{
+	Emit(0x66); Emit(0xC7); EmitMem(0, offPc); Emit16(value);
+}
+
+//run one instruction through Interpret. everything the handler might look at
+//(pc, I, V registers) is written back first and reloaded afterwards
+void Chip8Jit::CallInterpret(uint16_t address, uint16_t op)
+{
+	StorePC(address + 2);
+	SpillCache();
+	StoreIndex();
+
+#if defined(_WIN32)
+	Emit(0x48); Emit(0x89); Emit(0xD9);	//mov rcx, rbx
+	Emit(0xBA); Emit32(op);	//mov edx, op
+#else
+	Emit(0x48); Emit(0x89); Emit(0xDF);	//mov rdi, rbx
+	Emit(0xBE); Emit32(op);	//mov esi, op
+#endif
+	Emit(0x48); Emit(0xB8); Emit64(reinterpret_cast<uint64_t>(&Chip8Jit::Interpret));	//mov rax, Interpret
+	Emit(0xFF); Emit(0xD0);	//call rax
+
+	LoadCache();
+	LoadIndex();
+}
+
+//the flags of a compare are set, pc = condition ? address + 4 : address + 2
+void Chip8Jit::Skip(uint16_t address, uint8_t conditionCode)
+{
+	Emit(0xB8); Emit32(address + 2u);	//mov eax, address + 2
+	Emit(0xB9); Emit32(address + 4u);	//mov ecx, address + 4
+	Emit(0x0F); Emit(0x40 | conditionCode); Emit(0xC1);	//cmovcc eax, ecx
+	Emit(0x66); Emit(0x89); EmitMem(RAX, offPc);	//mov [pc], ax
+}
+
+void Chip8Jit::Prologue()
+{
+	Emit(0x53);	//push rbx
+	Emit(0x55);	//push rbp
+	Emit(0x41); Emit(0x54);	//push r12
+	Emit(0x41); Emit(0x55);	//push r13
+	Emit(0x41); Emit(0x56);	//push r14
+	Emit(0x41); Emit(0x57);	//push r15
+
+#if defined(_WIN32)
+	Emit(0x48); Emit(0x83); Emit(0xEC); Emit(0x28);	//sub rsp, 40 (shadow space + alignment)
+	Emit(0x48); Emit(0x89); Emit(0xCB);	//mov rbx, rcx
+#else
+	Emit(0x48); Emit(0x83); Emit(0xEC); Emit(0x08);	//sub rsp, 8 (alignment)
+	Emit(0x48); Emit(0x89); Emit(0xFB);	//mov rbx, rdi
+#endif
+
+	LoadIndex();
+	LoadCache();
+}
+
+void Chip8Jit::Epilogue()
+{
+#if defined(_WIN32)
+	Emit(0x48); Emit(0x83); Emit(0xC4); Emit(0x28);	//add rsp, 40
+#else
+	Emit(0x48); Emit(0x83); Emit(0xC4); Emit(0x08);	//add rsp, 8
+#endif
+
+	Emit(0x41); Emit(0x5F);	//pop r15
+	Emit(0x41); Emit(0x5E);	//pop r14
+	Emit(0x41); Emit(0x5D);	//pop r13
+	Emit(0x41); Emit(0x5C);	//pop r12
+	Emit(0x5D);	//pop rbp
+	Emit(0x5B);	//pop rbx
+	Emit(0xC3);	//ret
+}
+
+#endif
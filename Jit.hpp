@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "Chip8.hpp"
+
+//the recompiler emits x86-64 machine code, so it only exists on x86-64.
+//everywhere else Dispatch::Jit just runs the decoded interpreter
+#if defined(__x86_64__) || defined(_M_X64)
+#define CHIP8_HAS_JIT 1
+#else
+#define CHIP8_HAS_JIT 0
+#endif
+
+#if CHIP8_HAS_JIT
+
+//basic block recompiler for one Chip8.
+//a block starts at some pc and runs until the first instruction that changes
+//control flow (1NNN, 2NNN, 00EE, BNNN, skips) or has to wait/draw/write memory
+//(DXYN, FX0A, FX33, FX55, EX9E, EXA1). blocks are translated to native code the
+//first time their start address runs and are cached by that address.
+//
+//inside a block the Chip8 pointer lives in rbx, I in r13 and up to four of the
+//most used V registers in r12/r14/r15/rbp. pc is known while compiling, so it
+//is only written back when the block exits.
+//instructions that are not worth translating (draw, random, BCD, ...) call
+//back into the normal OP_* handler.
+class Chip8Jit
+{
+public:
+	explicit Chip8Jit(Chip8& chip);
+	~Chip8Jit();
+
+	Chip8Jit(Chip8Jit const&) = delete;
+	Chip8Jit& operator=(Chip8Jit const&) = delete;
+
+	//same contract as Chip8::Run, exactly "cycles" instructions get executed
+	void Run(uint64_t cycles);
+
+	//called when first..last were written, drops every block that was translated
+	//from one of those bytes
+	void Invalidate(unsigned int first, unsigned int last);
+
+	//drops every block
+	void Flush();
+
+private:
+	typedef void (*BlockFunc)(Chip8*);
+
+	struct Block
+	{
+		BlockFunc code;
+		uint16_t length;	//number of CHIP-8 instructions in the block
+	};
+
+	bool Compile(uint16_t address);
+	bool CompileInstruction(uint16_t address, uint16_t op);
+	void CountRegisterUses(uint16_t address, unsigned int length, unsigned int uses[REGISTER_COUNT]);
+	void InterpretOne();
+
+	static void Interpret(Chip8* chip, uint32_t opcode);
+
+	//raw code emission
+	void Emit(uint8_t byte);
+	void Emit16(uint16_t value);
+	void Emit32(uint32_t value);
+	void Emit64(uint64_t value);
+	void EmitMem(int reg, int32_t offset);
+
+	//building blocks for the instructions
+	void LoadV(int hostReg, unsigned int v);
+	void StoreV(unsigned int v, int hostReg);
+	void LoadCache();
+	void SpillCache();
+	void LoadIndex();
+	void StoreIndex();
+	void StorePC(uint16_t value);
+	void CallInterpret(uint16_t address, uint16_t op);
+	void Skip(uint16_t address, uint8_t conditionCode);
+	void Prologue();
+	void Epilogue();
+
+	Chip8& chip;
+
+	Block blocks[MEMORY_SIZE]{};
+	uint8_t covered[MEMORY_SIZE]{};	//1 = some block was translated from this byte
+
+	uint8_t* code{};
+	size_t codeSize{};
+	size_t codeUsed{};
+
+	//where the fields are inside Chip8
+	int32_t offRegisters{};
+	int32_t offIndex{};
+	int32_t offPc{};
+	int32_t offDelay{};
+	int32_t offSound{};
+	int32_t offStack{};
+	int32_t offSp{};
+
+	//state while compiling a block
+	int cache[REGISTER_COUNT]{};	//host register holding V[i], or -1
+};
+
+#else
+
+//nothing to recompile for, Chip8 never creates one of these
+class Chip8Jit
+{
+};
+
+#endif
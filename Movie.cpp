@@ -0,0 +1,192 @@
+#include "Movie.hpp"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+
+const uint8_t MOVIE_MAGIC[4] = { 'C', 'H', '8', 'M' };
+
+void Movie::Record(uint32_t frame, uint16_t keys)
+{
+	uint16_t previous = events.empty() ? 0 : events.back().keys;
+	if (keys != previous)
+	{
+		events.push_back(MovieEvent{ frame, keys });
+	}
+
+	if (frame + 1 > frames)
+	{
+		frames = frame + 1;
+	}
+}
+
+void PutMovieLE(std::vector<uint8_t>& out, uint64_t value, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		out.push_back((uint8_t)(value >> (8u * i)));
+	}
+}
+
+bool Movie::Save(char const* filename) const
+{
+	std::vector<uint8_t> out;
+	out.insert(out.end(), MOVIE_MAGIC, MOVIE_MAGIC + sizeof(MOVIE_MAGIC));
+	PutMovieLE(out, MOVIE_VERSION, 2);
+	PutMovieLE(out, 0, 2);
+	PutMovieLE(out, seed, 8);
+	PutMovieLE(out, cyclesPerFrame, 4);
+	PutMovieLE(out, romHash, 8);
+	PutMovieLE(out, frames, 4);
+	PutMovieLE(out, events.size(), 4);
+
+	uint32_t lastFrame = 0;
+	for (MovieEvent const& event : events)
+	{
+		uint32_t delta = event.frame - lastFrame;
+		while (delta >= 0x80)
+		{
+			out.push_back((uint8_t)(delta | 0x80u));
+			delta >>= 7u;
+		}
+		out.push_back((uint8_t)delta);
+		PutMovieLE(out, event.keys, 2);
+
+		lastFrame = event.frame;
+	}
+
+	std::ofstream file(filename, std::ios::binary);
+	file.write(reinterpret_cast<char const*>(out.data()), out.size());
+
+	return file.good();
+}
+
+bool Movie::Load(char const* filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	size_t position = 0;
+	bool failed = false;
+
+	auto get = [&](unsigned int size)
+	{
+		uint64_t value = 0;
+		if (size > data.size() - position)
+		{
+			failed = true;
+			return value;
+		}
+
+		for (unsigned int i = 0; i < size; ++i)
+		{
+			value |= (uint64_t)data[position++] << (8u * i);
+		}
+		return value;
+	};
+
+	if (data.size() < sizeof(MOVIE_MAGIC) || memcmp(data.data(), MOVIE_MAGIC, sizeof(MOVIE_MAGIC)) != 0)
+	{
+		return false;
+	}
+	position = sizeof(MOVIE_MAGIC);
+
+	uint16_t version = (uint16_t)get(2);
+	get(2);
+	if (failed || version != MOVIE_VERSION)
+	{
+		return false;
+	}
+
+	Movie loaded;
+	loaded.seed = get(8);
+	loaded.cyclesPerFrame = (uint32_t)get(4);
+	loaded.romHash = get(8);
+	loaded.frames = (uint32_t)get(4);
+	uint32_t eventCount = (uint32_t)get(4);
+
+	uint32_t frame = 0;
+	for (uint32_t i = 0; i < eventCount && !failed; ++i)
+	{
+		uint32_t delta = 0;
+		unsigned int shift = 0;
+		uint8_t byte;
+		do
+		{
+			byte = (uint8_t)get(1);
+			delta |= (uint32_t)(byte & 0x7Fu) << shift;
+			shift += 7;
+		} while ((byte & 0x80u) && shift < 35 && !failed);
+
+		frame += delta;
+		loaded.events.push_back(MovieEvent{ frame, (uint16_t)get(2) });
+	}
+
+	if (failed || loaded.cyclesPerFrame == 0)
+	{
+		return false;
+	}
+
+	*this = std::move(loaded);
+	return true;
+}
+
+uint16_t MoviePlayer::KeysFor(uint32_t frame)
+{
+	while (next < movie.events.size() && movie.events[next].frame <= frame)
+	{
+		keys = movie.events[next].keys;
+		++next;
+	}
+
+	return keys;
+}
+
+uint16_t KeypadMask(uint8_t const* keypad)
+{
+	uint16_t mask = 0;
+	for (unsigned int i = 0; i < KEY_COUNT; ++i)
+	{
+		mask |= (keypad[i] != 0 ? 1u : 0u) << i;
+	}
+	return mask;
+}
+
+void SetKeypad(uint8_t* keypad, uint16_t mask)
+{
+	for (unsigned int i = 0; i < KEY_COUNT; ++i)
+	{
+		keypad[i] = (mask >> i) & 1u;
+	}
+}
+
+uint64_t MovieRomHash(Chip8 const& chip8)
+{
+	//64 bit FNV-1a
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (unsigned int i = 0; i < MEMORY_SIZE; ++i)
+	{
+		hash ^= chip8.GetMemory()[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+uint64_t PlayMovie(Chip8& chip8, Movie const& movie)
+{
+	MoviePlayer player(movie);
+	uint64_t cycles = 0;
+
+	for (uint32_t frame = 0; !player.Finished(frame); ++frame)
+	{
+		SetKeypad(chip8.keypad, player.KeysFor(frame));
+		cycles += chip8.Run(movie.cyclesPerFrame);
+		chip8.TickTimers();
+	}
+
+	return cycles;
+}
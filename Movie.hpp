@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Chip8.hpp"
+
+
+//input recording.
+//a run of the emulator only depends on the ROM, the random seed, the number
+//of instructions per frame and which keys were down in which frame. a movie
+//stores exactly that, so playing it back gives the same run every time, in
+//the window or headless at full speed.
+//
+//keys are read once per frame, so a movie only needs the frames where the
+//keys changed. on disk (little endian):
+//
+//  "CH8M"          magic
+//  u16 version     MOVIE_VERSION
+//  u16             0
+//  u64 seed
+//  u32 cycles per frame
+//  u64 ROM hash    of the memory right after loading the ROM (see MovieRomHash)
+//  u32 frames      length of the movie
+//  u32 events
+//  events          varint frames since the last event, u16 key mask
+//version 1 movies were made with std::default_random_engine and would play
+//back differently with the counter based generators, so they are refused
+const uint16_t MOVIE_VERSION = 2;
+
+struct MovieEvent
+{
+	uint32_t frame;
+	uint16_t keys;	//bit i = key i is down
+};
+
+struct Movie
+{
+	uint64_t seed{};
+	uint32_t cyclesPerFrame{ 10 };
+	uint64_t romHash{};
+	uint32_t frames{};
+	std::vector<MovieEvent> events;
+
+	//call once per frame, before the frame runs. only changes get stored
+	void Record(uint32_t frame, uint16_t keys);
+
+	bool Save(char const* filename) const;
+	bool Load(char const* filename);
+};
+
+//hands out the keys of a movie frame by frame
+class MoviePlayer
+{
+public:
+	explicit MoviePlayer(Movie const& movie) : movie(movie) {}
+
+	//frames have to be asked for in order
+	uint16_t KeysFor(uint32_t frame);
+	bool Finished(uint32_t frame) const { return frame >= movie.frames; }
+
+private:
+	Movie const& movie;
+	size_t next{};
+	uint16_t keys{};
+};
+
+uint16_t KeypadMask(uint8_t const* keypad);
+void SetKeypad(uint8_t* keypad, uint16_t mask);
+
+//identifies the ROM a movie was recorded with
+uint64_t MovieRomHash(Chip8 const& chip8);
+
+//play a whole movie on chip8 (which has to be freshly loaded and seeded with
+//movie.seed). no window and no pacing, it runs as fast as the core can.
+//returns the number of instructions that ran
+uint64_t PlayMovie(Chip8& chip8, Movie const& movie);
@@ -7,12 +7,20 @@
 
 #include "Platform.hpp"
 #include "SDL.h"
+#include "Telemetry.hpp"
+#include "array"
+#include "cstring"
 
-Platform::Platform(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight)
+//the emulator runs at 60 Hz, the frame numbers Update gets count those frames
+const std::chrono::steady_clock::duration FRAME_PERIOD =
+	std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / 60.0));
+
+Platform::Platform(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight, bool vsync)
+	: textureWidth(textureWidth), textureHeight(textureHeight), frames((size_t)textureWidth * textureHeight * 4)
 {
 		SDL_Init(SDL_INIT_VIDEO);
 		window = SDL_CreateWindow(title, 0, 0, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
-		renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+		renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
 		texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
 }
 
@@ -24,135 +32,254 @@ Platform::~Platform()
 	SDL_Quit();
 }
 
-void Platform::Update(void const* buffer, int pitch)
+void Platform::Update(void const* buffer, int pitch, uint64_t frame)
+{
+	//RGBA8888, 4 bytes a pixel
+	int rowBytes = textureWidth * 4;
+	uint8_t* back = static_cast<uint8_t*>(frames.Back());
+	uint8_t const* rows = static_cast<uint8_t const*>(buffer);
+	for (int y = 0; y < textureHeight; ++y)
+	{
+		memcpy(back + y * rowBytes, rows + y * pitch, rowBytes);
+	}
+
+	if (!frames.Publish(frame))
+	{
+		droppedFrames.fetch_add(1, std::memory_order_relaxed);
+		FrameTelemetry* frameTelemetry = telemetry.load(std::memory_order_acquire);
+		if (frameTelemetry != nullptr)
+		{
+			frameTelemetry->AddDroppedFrames(1);
+		}
+	}
+
+	//pairs with the fence in ProcessEvents: either the main thread sees the
+	//new frame after its last wake up, or we see that it took that wake up
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!wakePending.exchange(true, std::memory_order_relaxed))
+	{
+		Wake();
+	}
+}
+
+void Platform::Wake()
 {
-	SDL_UpdateTexture(texture, nullptr, buffer, pitch);
+	//SDL_PushEvent is fine from any thread, and ends SDL_WaitEvent
+	SDL_Event event{};
+	event.type = SDL_USEREVENT;
+	SDL_PushEvent(&event);
+}
+
+bool Platform::ProcessEvents()
+{
+	bool quit = false;
+	SDL_Event event;
+
+	//sleep until something happens: a key, the window, a frame or a title from the emulator
+	if (!SDL_WaitEvent(&event))
+	{
+		//SDL cant wait for events any more, there is no way to go on
+		return true;
+	}
+
+	do
+	{
+		HandleEvent(event, quit);
+	} while (SDL_PollEvent(&event));
+
+	wakePending.store(false, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	Present();
+
+	{
+		std::lock_guard<std::mutex> lock(titleLock);
+		if (titleChanged)
+		{
+			SDL_SetWindowTitle(window, newTitle.c_str());
+			titleChanged = false;
+		}
+	}
+
+	return quit;
+}
+
+void Platform::Present()
+{
+	//the newest frame, whatever got published while we were presenting the last one
+	if (!frames.Take())
+	{
+		return;
+	}
+	FrameTelemetry* frameTelemetry = telemetry.load(std::memory_order_acquire);
+
+	auto start = Clock::now();
+	SDL_UpdateTexture(texture, nullptr, frames.Front(), textureWidth * 4);
+	auto uploaded = Clock::now();
 	SDL_RenderClear(renderer);
 	SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+	auto copied = Clock::now();
 	SDL_RenderPresent(renderer);
+	auto presented = Clock::now();
+
+	//more 60 Hz frames went by since the last present than the emulator
+	//counted between the two frames: the old one stayed up for the difference
+	uint64_t duplicated = 0;
+	if (presentedBefore)
+	{
+		uint64_t periods = (uint64_t)((presented - lastPresent + FRAME_PERIOD / 2) / FRAME_PERIOD);
+		uint64_t advanced = frames.FrontFrame() - lastFrame;
+		duplicated = periods > advanced ? periods - advanced : 0;
+		duplicatedFrames.fetch_add(duplicated, std::memory_order_relaxed);
+	}
+	presentedBefore = true;
+	lastFrame = frames.FrontFrame();
+	lastPresent = presented;
+
+	InputPresented(frames.FrontFrame(), presented, frameTelemetry);
+
+	if (frameTelemetry != nullptr)
+	{
+		frameTelemetry->Record(FrameStage::Upload, uploaded - start);
+		frameTelemetry->Record(FrameStage::Present, presented - copied);
+		frameTelemetry->AddDuplicatedFrames(duplicated);
+	}
 }
 
-bool Platform::ProcessInput(uint8_t* keys)
+void Platform::SetTitle(char const* title)
 {
-	bool quit = false;
-	SDL_Event event;
-	while (SDL_PollEvent(&event))
 	{
-		switch (event.type)
+		std::lock_guard<std::mutex> lock(titleLock);
+		newTitle = title;
+		titleChanged = true;
+	}
+	Wake();
+}
+
+int Platform::RefreshRate() const
+{
+	SDL_DisplayMode mode{};
+	if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) != 0)
+	{
+		return 0;
+	}
+
+	return mode.refresh_rate;
+}
+
+//the CHIP-8 keypad on the left of a QWERTY keyboard
+//  1 2 3 C      1 2 3 4
+//  4 5 6 D  ->  Q W E R
+//  7 8 9 E      A S D F
+//  A 0 B F      Z X C V
+//keymap[k] is the key for CHIP-8 key k
+const SDL_Keycode keymap[] =
+{
+	SDLK_x, SDLK_1, SDLK_2, SDLK_3,
+	SDLK_q, SDLK_w, SDLK_e, SDLK_a,
+	SDLK_s, SDLK_d, SDLK_z, SDLK_c,
+	SDLK_4, SDLK_r, SDLK_f, SDLK_v,
+};
+
+//the other way around, SDL keycode -> CHIP-8 key or -1.
+//every key of the keymap is a plain character, so 128 entries are enough
+const std::array<int8_t, 128> keypadKeys = []()
+{
+	std::array<int8_t, 128> keys{};
+	for (int8_t& key : keys) { key = -1; }
+	for (unsigned int k = 0; k < sizeof(keymap) / sizeof(keymap[0]); ++k)
+	{
+		keys[keymap[k]] = (int8_t)k;
+	}
+	return keys;
+}();
+
+int KeypadKey(SDL_Keycode key)
+{
+	return key >= 0 && key < (SDL_Keycode)keypadKeys.size() ? keypadKeys[key] : -1;
+}
+
+void Platform::HandleEvent(SDL_Event const& event, bool& quit)
+{
+	switch (event.type)
+	{
+		case SDL_QUIT:
+			quit = true;
+			break;
+		case SDL_KEYDOWN:
+		case SDL_KEYUP:
 		{
-			case SDL_QUIT:
-				quit = true;
-				break;
-			case SDL_KEYDOWN:
-				switch (event.key.keysym.sym)
+			bool down = event.type == SDL_KEYDOWN;
+			int key = KeypadKey(event.key.keysym.sym);
+
+			if (key >= 0)
+			{
+				uint16_t bit = (uint16_t)(1u << key);
+				uint16_t old = down ? keys.fetch_or(bit, std::memory_order_relaxed) : keys.fetch_and((uint16_t)~bit, std::memory_order_relaxed);
+
+				//holding a key down repeats the event, only a change is input
+				size_t head = inputHead.load(std::memory_order_relaxed);
+				if (((old & bit) != 0) != down && head - inputTail < INPUT_EVENTS)
 				{
-					case SDLK_ESCAPE:
-						quit = true;
-						break;
-					case SDLK_x:
-						keys[0] = 1;
-						break;
-					case SDLK_1:
-						keys[1] = 1;
-						break;
-					case SDLK_2:
-						keys[2] = 1;
-						break;
-					case SDLK_3:
-						keys[3] = 1;
-						break;
-					case SDLK_q:
-						keys[4] = 1;
-						break;
-					case SDLK_w:
-						keys[5] = 1;
-						break;
-					case SDLK_e:
-						keys[6] = 1;
-						break;
-					case SDLK_a:
-						keys[7] = 1;
-						break;
-					case SDLK_s:
-						keys[8] = 1;
-						break;
-					case SDLK_d:
-						keys[9] = 1;
-						break;
-					case SDLK_z:
-						keys[0xA] = 1;
-						break;
-					case SDLK_c:
-						keys[0xB] = 1;
-						break;
-					case SDLK_4:
-						keys[0xC] = 1;
-						break;
-					case SDLK_r:
-						keys[0xD] = 1;
-						 break;
-					case SDLK_f:
-						keys[0xE] = 1;
-						break;
-					case SDLK_v:
-						keys[0xF] = 1;
-						break;
+					//SDL stamps events in milliseconds since SDL_Init. the age
+					//includes the time the event sat in the queue before we looked
+					Uint32 age = SDL_GetTicks() - event.key.timestamp;
+					inputEvents[head % INPUT_EVENTS].time = Clock::now() - std::chrono::milliseconds(age < 1000 ? age : 0);
+					//release: ReadKeys that sees the event sees the key too
+					inputHead.store(head + 1, std::memory_order_release);
 				}
 				break;
-			case SDL_KEYUP:
+			}
+
+			if (event.key.keysym.sym == SDLK_BACKSPACE)
+			{
+				rewinding.store(down, std::memory_order_relaxed);
+			}
+			//holding the key down repeats the event, only act once
+			else if (down && event.key.repeat == 0)
+			{
 				switch (event.key.keysym.sym)
 				{
-					case SDLK_x:
-						keys[0] = 0;
-						break;
-					case SDLK_1:
-						keys[1] = 0;
-						break;
-					case SDLK_2:
-						keys[2] = 0;
-						break;
-					case SDLK_3:
-						keys[3] = 0;
-						break;
-					case SDLK_q:
-						keys[4] = 0;
-						break;
-					case SDLK_w:
-						keys[5] = 0;
-						break;
-					case SDLK_e:
-						keys[6] = 0;
-						break;
-					case SDLK_a:
-						keys[7] = 0;
-						break;
-					case SDLK_s:
-						keys[8] = 0;
-						break;
-					case SDLK_d:
-						keys[9] = 0;
-						break;
-					case SDLK_z:
-						keys[0xA] = 0;
-						break;
-					case SDLK_c:
-						keys[0xB] = 0;
-						break;
-					case SDLK_4:
-						keys[0xC] = 0;
-						break;
-					case SDLK_r:
-						keys[0xD] = 0;
+					case SDLK_ESCAPE:
+						quit = true;
 						break;
-					case SDLK_f:
-						keys[0xE] = 0;
+					case SDLK_TAB:
+						turbo.store(!turbo.load(std::memory_order_relaxed), std::memory_order_relaxed);
 						break;
-					case SDLK_v:
-						keys[0xF] = 0;
+					case SDLK_F1:
+						dumpRequested.store(true, std::memory_order_relaxed);
 						break;
 				}
-				break;
+			}
+			break;
 		}
 	}
-	return quit;
-}
\ No newline at end of file
+}
+
+uint16_t Platform::ReadKeys(uint64_t frame)
+{
+	//the key events that came in since the last call are this frame's. they
+	//are tagged before the keys are loaded, so the keys include all of them
+	//(one that comes in between counts for the next frame)
+	size_t head = inputHead.load(std::memory_order_acquire);
+	for (size_t i = inputRead.load(std::memory_order_relaxed); i != head; ++i)
+	{
+		inputEvents[i % INPUT_EVENTS].frame = frame;
+	}
+	inputRead.store(head, std::memory_order_release);
+
+	return keys.load(std::memory_order_relaxed);
+}
+
+void Platform::InputPresented(uint64_t frame, Clock::time_point presented, FrameTelemetry* frameTelemetry)
+{
+	//frames can be skipped or dropped, the first one presented after them shows their input too
+	size_t read = inputRead.load(std::memory_order_acquire);
+	while (inputTail != read && inputEvents[inputTail % INPUT_EVENTS].frame <= frame)
+	{
+		if (frameTelemetry != nullptr)
+		{
+			frameTelemetry->RecordInputToPhoton(presented - inputEvents[inputTail % INPUT_EVENTS].time);
+		}
+		++inputTail;
+	}
+}
@@ -7,18 +7,122 @@
 
 #pragma once
 #include "SDL.h"
+#include "TripleBuffer.hpp"
+#include "atomic"
+#include "chrono"
 #include "cstdint"
+#include "mutex"
+#include "string"
 
+class FrameTelemetry;
+
+//the window, the keyboard and the renderer, all on the thread that made the
+//Platform (the main thread: SDL wants events there, macOS wants the renderer
+//there too, and the renderer watches the window events). the emulator runs on
+//a thread of its own and hands its frames over with Update, which only copies
+//the frame into a triple buffer and returns, so waiting for vsync (or a slow
+//driver) never holds up the emulator. ProcessEvents on the main thread then
+//uploads and presents the newest frame there is
 class Platform
 {
 public:
-	Platform(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight);
+	//vsync = presenting waits for the display refresh instead of presenting right away
+	Platform(char const* title, int windowWidth, int windowHeight, int textureWidth, int textureHeight, bool vsync = false);
 	~Platform();
-	void Update(void const* buffer, int pitch);
-	bool ProcessInput(uint8_t* keys);
+
+	//main thread: wait for events and handle them, present the newest frame
+	//if Update gave a new one. true when it is time to quit
+	bool ProcessEvents();
+
+	//emulator thread: hand a textureWidth x textureHeight RGBA frame over.
+	//frame is the number of the emulator frame it belongs to (60 per second),
+	//it is what the dropped and duplicated frames are counted with
+	void Update(void const* buffer, int pitch, uint64_t frame);
+	//emulator thread: the CHIP-8 keys that are held (bit k = key k, the same
+	//as KeypadMask in Movie.hpp). call it right before running frame, the key
+	//presses and releases since the last call are then timed until frame is on the screen
+	uint16_t ReadKeys(uint64_t frame);
+	//any thread, the main thread sets it the next time it handles events
+	void SetTitle(char const* title);
+
+	//refresh rate of the display the window is on, 0 when SDL doesnt know it (main thread)
+	int RefreshRate() const;
+
+	//Tab switches turbo mode on and off
+	bool Turbo() const { return turbo.load(std::memory_order_relaxed); }
+	void SetTurbo(bool on) { turbo.store(on, std::memory_order_relaxed); }
+
+	//true while Backspace is held down
+	bool Rewinding() const { return rewinding.load(std::memory_order_relaxed); }
+
+	//when set, presenting records how long the texture upload and the present
+	//take, and how long it took from a key event to the first frame that saw
+	//it being on the screen. the dropped and duplicated frames are added to it
+	void SetTelemetry(FrameTelemetry* frameTelemetry) { telemetry.store(frameTelemetry, std::memory_order_release); }
+
+	//frames given to Update that were replaced by a newer one before they were presented
+	uint64_t DroppedFrames() const { return droppedFrames.load(std::memory_order_relaxed); }
+	//60 Hz frames that the screen went on showing an old frame for, because
+	//the new one came late (a slow present, or an emulator that fell behind).
+	//frames the emulator chose not to show (frame skip, an idle screen) dont count
+	uint64_t DuplicatedFrames() const { return duplicatedFrames.load(std::memory_order_relaxed); }
+
+	//true once for every press of F1
+	bool TakeDumpRequest() { return dumpRequested.exchange(false, std::memory_order_relaxed); }
 private:
+	typedef std::chrono::steady_clock Clock;
+
+	//a key event, and the frame that saw it once ReadKeys got to it
+	struct InputEvent
+	{
+		Clock::time_point time;
+		uint64_t frame;
+	};
+	//key events that can wait for their frame at once, more are not timed
+	static const size_t INPUT_EVENTS = 64;
+
+	void HandleEvent(SDL_Event const& event, bool& quit);
+	void Present();
+	//wake the main thread up from waiting for events
+	void Wake();
+	//time the key events of frames up to frame, which was presented at presented
+	void InputPresented(uint64_t frame, Clock::time_point presented, FrameTelemetry* frameTelemetry);
+
 	SDL_Window* window{};
 	SDL_Renderer* renderer{};
 	SDL_Texture* texture{};
-};
+	int textureWidth;
+	int textureHeight;
+
+	std::atomic<bool> turbo{};
+	std::atomic<bool> rewinding{};
+	std::atomic<bool> dumpRequested{};
+	std::atomic<FrameTelemetry*> telemetry{};
+
+	//the keypad as a mask, written by the main thread and read by ReadKeys
+	std::atomic<uint16_t> keys{};
+	//the key events go around in a ring: the main thread adds them at
+	//inputHead, ReadKeys gives everything up to there its frame and moves
+	//inputRead along, and presenting takes them out at inputTail
+	InputEvent inputEvents[INPUT_EVENTS];
+	std::atomic<size_t> inputHead{};
+	std::atomic<size_t> inputRead{};
+	size_t inputTail{};	//main thread only
 
+	TripleBuffer frames;
+	std::atomic<uint64_t> droppedFrames{};
+	std::atomic<uint64_t> duplicatedFrames{};
+
+	//for counting the duplicated frames (main thread)
+	bool presentedBefore{};
+	uint64_t lastFrame{};
+	Clock::time_point lastPresent;
+
+	//Update only wakes the main thread when there isnt a wake up on its way already
+	std::atomic<bool> wakePending{};
+
+	//SetTitle leaves the title here for the main thread
+	std::mutex titleLock;
+	std::string newTitle;
+	bool titleChanged{};	//guarded by titleLock
+};
@@ -0,0 +1,181 @@
+#include "Profile.hpp"
+
+#if CHIP8_PROFILE
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+const unsigned int PROFILE_ROOT = 0x200;	//START_ADDRESS, where code outside any call belongs
+
+const char* const opcodeClassNames[OPC_COUNT] =
+{
+	"00E0", "00EE", "1NNN", "2NNN", "3XKK", "4XKK", "5XY0",
+	"6XKK", "7XKK", "8XY0", "8XY1", "8XY2", "8XY3", "8XY4",
+	"8XY5", "8XY6", "8XY7", "8XYE", "9XY0", "ANNN", "BNNN",
+	"CXKK", "DXYN", "EX9E", "EXA1", "FX07", "FX0A", "FX15",
+	"FX18", "FX1E", "FX29", "FX33", "FX55", "FX65", "NULL",
+};
+
+//the same bits the tables look at: the top nibble, then the last
+//nibble for 0/8/E, or the last byte for F
+OpcodeClass ClassifyOpcode(uint16_t opcode)
+{
+	switch (opcode >> 12u)
+	{
+		case 0x0:
+			switch (opcode & 0x000Fu)
+			{
+				case 0x0: return OPC_00E0;
+				case 0xE: return OPC_00EE;
+			}
+			break;
+		case 0x1: return OPC_1NNN;
+		case 0x2: return OPC_2NNN;
+		case 0x3: return OPC_3XKK;
+		case 0x4: return OPC_4XKK;
+		case 0x5: return OPC_5XY0;
+		case 0x6: return OPC_6XKK;
+		case 0x7: return OPC_7XKK;
+		case 0x8:
+			switch (opcode & 0x000Fu)
+			{
+				case 0x0: return OPC_8XY0;
+				case 0x1: return OPC_8XY1;
+				case 0x2: return OPC_8XY2;
+				case 0x3: return OPC_8XY3;
+				case 0x4: return OPC_8XY4;
+				case 0x5: return OPC_8XY5;
+				case 0x6: return OPC_8XY6;
+				case 0x7: return OPC_8XY7;
+				case 0xE: return OPC_8XYE;
+			}
+			break;
+		case 0x9: return OPC_9XY0;
+		case 0xA: return OPC_ANNN;
+		case 0xB: return OPC_BNNN;
+		case 0xC: return OPC_CXKK;
+		case 0xD: return OPC_DXYN;
+		case 0xE:
+			switch (opcode & 0x000Fu)
+			{
+				case 0x1: return OPC_EXA1;
+				case 0xE: return OPC_EX9E;
+			}
+			break;
+		case 0xF:
+			switch (opcode & 0x00FFu)
+			{
+				case 0x07: return OPC_FX07;
+				case 0x0A: return OPC_FX0A;
+				case 0x15: return OPC_FX15;
+				case 0x18: return OPC_FX18;
+				case 0x1E: return OPC_FX1E;
+				case 0x29: return OPC_FX29;
+				case 0x33: return OPC_FX33;
+				case 0x55: return OPC_FX55;
+				case 0x65: return OPC_FX65;
+			}
+			break;
+	}
+
+	return OPC_NULL;
+}
+
+char const* OpcodeClassName(unsigned int opcodeClass)
+{
+	return opcodeClass < OPC_COUNT ? opcodeClassNames[opcodeClass] : "?";
+}
+
+void Chip8Profile::Clear()
+{
+	memset(static_cast<void*>(this), 0, sizeof(*this));
+	frames[0] = PROFILE_ROOT;
+}
+
+//indexes of the non zero entries of counts, biggest count first
+std::vector<unsigned int> SortedByCount(uint64_t const* counts, unsigned int size)
+{
+	std::vector<unsigned int> order;
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		if (counts[i] != 0)
+		{
+			order.push_back(i);
+		}
+	}
+
+	std::stable_sort(order.begin(), order.end(), [counts](unsigned int a, unsigned int b)
+	{
+		return counts[a] > counts[b];
+	});
+
+	return order;
+}
+
+double Percent(uint64_t part, uint64_t total)
+{
+	return total != 0 ? 100.0 * part / total : 0.0;
+}
+
+void Chip8Profile::Report(FILE* out, uint8_t const* memory, unsigned int hotSpots) const
+{
+	std::fprintf(out, "profile: %llu instructions\n", (unsigned long long)instructions);
+
+	std::fprintf(out, "\nopcode classes:\n");
+	for (unsigned int opcodeClass : SortedByCount(classCount, OPC_COUNT))
+	{
+		std::fprintf(out, "  %s %14llu %6.2f%%\n", OpcodeClassName(opcodeClass),
+			(unsigned long long)classCount[opcodeClass], Percent(classCount[opcodeClass], instructions));
+	}
+
+	std::fprintf(out, "\nhot spots:\n");
+	std::vector<unsigned int> hottest = SortedByCount(pcCount, PROFILE_ADDRESSES);
+	if (hottest.size() > hotSpots)
+	{
+		hottest.resize(hotSpots);
+	}
+	for (unsigned int address : hottest)
+	{
+		uint16_t opcode = address + 1 < PROFILE_ADDRESSES ? (memory[address] << 8u) | memory[address + 1] : 0;
+		std::fprintf(out, "  %03X %04X %s %14llu %6.2f%%\n", address, opcode, OpcodeClassName(ClassifyOpcode(opcode)),
+			(unsigned long long)pcCount[address], Percent(pcCount[address], instructions));
+	}
+
+	std::fprintf(out, "\ncalls: %llu, deepest: %u\n", (unsigned long long)calls, maxDepth);
+	for (unsigned int level = 0; level <= maxDepth; ++level)
+	{
+		std::fprintf(out, "  depth %2u %14llu %6.2f%%\n", level,
+			(unsigned long long)depthCount[level], Percent(depthCount[level], instructions));
+	}
+
+	std::fprintf(out, "\nDXYN: %llu draws, %.3f ms, %.1f ns per draw\n", (unsigned long long)draws,
+		drawNanoseconds / 1e6, draws != 0 ? (double)drawNanoseconds / draws : 0.0);
+}
+
+bool Chip8Profile::WriteFlatProfile(char const* filename) const
+{
+	FILE* out = std::fopen(filename, "w");
+	if (out == nullptr)
+	{
+		return false;
+	}
+
+	std::fprintf(out, "Flat profile:\n\n");
+	std::fprintf(out, "Each sample counts as 1 instruction.\n");
+	std::fprintf(out, "  %%   cumulative         self            calls  name\n");
+	std::fprintf(out, " time  instructions       instructions\n");
+
+	uint64_t cumulative = 0;
+	for (unsigned int function : SortedByCount(selfCount, PROFILE_ADDRESSES))
+	{
+		cumulative += selfCount[function];
+		std::fprintf(out, "%6.2f %14llu %14llu %14llu  sub_%03X\n", Percent(selfCount[function], instructions),
+			(unsigned long long)cumulative, (unsigned long long)selfCount[function],
+			(unsigned long long)callCount[function], function);
+	}
+
+	return std::fclose(out) == 0;
+}
+
+#endif
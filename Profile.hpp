@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+
+//optional profiler for Chip8::Cycle.
+//build everything with -DCHIP8_PROFILE=1 (and add Profile.cpp) to get it.
+//without it Chip8 has no profile member and Cycle has no extra code,
+//so a normal build pays nothing at all.
+//a profiling build runs every Dispatch mode through Cycle, the faster
+//cores skip it and would not be counted.
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
+
+#if CHIP8_PROFILE
+
+//addresses are 12 bits
+const unsigned int PROFILE_ADDRESSES = 0x1000;
+//deeper calls (a stack overflow) are counted as this depth
+const unsigned int PROFILE_MAX_DEPTH = 16;
+
+//the instruction classes the OP_* handlers implement, plus one for
+//opcodes that end up in OP_NULL
+enum OpcodeClass
+{
+	OPC_00E0, OPC_00EE, OPC_1NNN, OPC_2NNN, OPC_3XKK, OPC_4XKK, OPC_5XY0,
+	OPC_6XKK, OPC_7XKK, OPC_8XY0, OPC_8XY1, OPC_8XY2, OPC_8XY3, OPC_8XY4,
+	OPC_8XY5, OPC_8XY6, OPC_8XY7, OPC_8XYE, OPC_9XY0, OPC_ANNN, OPC_BNNN,
+	OPC_CXKK, OPC_DXYN, OPC_EX9E, OPC_EXA1, OPC_FX07, OPC_FX0A, OPC_FX15,
+	OPC_FX18, OPC_FX1E, OPC_FX29, OPC_FX33, OPC_FX55, OPC_FX65, OPC_NULL,
+	OPC_COUNT
+};
+
+//which class an opcode belongs to, decoded the same way Cycle() does
+OpcodeClass ClassifyOpcode(uint16_t opcode);
+char const* OpcodeClassName(unsigned int opcodeClass);
+
+//what one Chip8 spent its instructions on since the last Clear().
+//a "function" is a subroutine, named by the address 2NNN called. code that
+//is not inside any call belongs to the function at START_ADDRESS
+struct Chip8Profile
+{
+	uint64_t instructions;
+	uint64_t classCount[OPC_COUNT];
+	uint64_t pcCount[PROFILE_ADDRESSES];	//executions of the instruction at each address
+
+	//call tracking. frames mirrors the CHIP-8 stack, but with the called
+	//addresses instead of the return addresses
+	uint64_t calls;
+	uint64_t callCount[PROFILE_ADDRESSES];	//calls made to each address
+	uint64_t selfCount[PROFILE_ADDRESSES];	//instructions run inside each function
+	uint64_t depthCount[PROFILE_MAX_DEPTH + 1];	//instructions run at each call depth
+	uint16_t frames[PROFILE_MAX_DEPTH + 1];
+	unsigned int depth;
+	unsigned int maxDepth;
+
+	//time spent inside OP_DXYN
+	uint64_t draws;
+	uint64_t drawNanoseconds;
+
+	Chip8Profile() { Clear(); }
+	void Clear();
+
+	//called by Cycle() for every instruction, before it runs
+	void Count(uint16_t address, uint16_t opcode)
+	{
+		OpcodeClass opcodeClass = ClassifyOpcode(opcode);
+
+		++instructions;
+		++classCount[opcodeClass];
+		++pcCount[address & (PROFILE_ADDRESSES - 1)];
+		++selfCount[frames[depth]];
+		++depthCount[depth];
+
+		//the call belongs to the caller and the return to the callee,
+		//so the function only changes after they are counted
+		if (opcodeClass == OPC_2NNN)
+		{
+			uint16_t target = opcode & 0x0FFFu;
+
+			++calls;
+			++callCount[target];
+			depth = depth < PROFILE_MAX_DEPTH ? depth + 1 : depth;
+			maxDepth = depth > maxDepth ? depth : maxDepth;
+			frames[depth] = target;
+		}
+		else if (opcodeClass == OPC_00EE && depth > 0)
+		{
+			--depth;
+		}
+	}
+
+	void Draw(uint64_t nanoseconds)
+	{
+		++draws;
+		drawNanoseconds += nanoseconds;
+	}
+
+	//the instruction classes, the hottest addresses, the call depths and the
+	//draw time, sorted from the most executed down. memory is only used to
+	//show the opcode at each hot address
+	void Report(FILE* out, uint8_t const* memory, unsigned int hotSpots = 20) const;
+
+	//gprof style flat profile, one line per function, sorted by the
+	//instructions run inside it. returns false if the file cant be written
+	bool WriteFlatProfile(char const* filename) const;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+
+
+//random numbers for CXKK.
+//both generators are counter based: number n of a stream is a pure function
+//of (key, n), there is no hidden engine state. a Chip8 only has to keep its
+//key and a counter, which makes savestates tiny and exact, and any number of
+//instances get independent streams just by using different stream ids with
+//the same seed.
+//
+//a generator is a struct with two static functions:
+//  Key(seed, stream)   the key of one stream
+//  Next(key, counter)  64 random bits
+//Chip8Random picks the one Chip8 uses. SplitMix is the default, build with
+//CHIP8_RANDOM_PHILOX to use Philox instead.
+
+//splitmix64 (Steele, Lea, Flood). one multiply-xorshift finalizer per number
+struct SplitMixRandom
+{
+	static constexpr uint64_t Mix(uint64_t z)
+	{
+		z = (z ^ (z >> 30u)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27u)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31u);
+	}
+
+	static uint64_t Key(uint64_t seed, uint64_t stream)
+	{
+		return Mix(seed ^ Mix(stream + 0x9E3779B97F4A7C15ull));
+	}
+
+	static uint64_t Next(uint64_t key, uint64_t counter)
+	{
+		return Mix(key + (counter + 1) * 0x9E3779B97F4A7C15ull);
+	}
+};
+
+//Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+//slower than SplitMix but a much stronger generator
+struct PhiloxRandom
+{
+	static uint64_t Key(uint64_t seed, uint64_t stream)
+	{
+		return SplitMixRandom::Key(seed, stream);
+	}
+
+	static uint64_t Next(uint64_t key, uint64_t counter)
+	{
+		uint32_t c0 = (uint32_t)counter;
+		uint32_t c1 = (uint32_t)(counter >> 32u);
+		uint32_t c2 = 0;
+		uint32_t c3 = 0;
+		uint32_t k0 = (uint32_t)key;
+		uint32_t k1 = (uint32_t)(key >> 32u);
+
+		for (unsigned int round = 0; round < 10; ++round)
+		{
+			uint64_t product0 = (uint64_t)0xD2511F53u * c0;
+			uint64_t product1 = (uint64_t)0xCD9E8D57u * c2;
+
+			uint32_t n0 = (uint32_t)(product1 >> 32u) ^ c1 ^ k0;
+			uint32_t n1 = (uint32_t)product1;
+			uint32_t n2 = (uint32_t)(product0 >> 32u) ^ c3 ^ k1;
+			uint32_t n3 = (uint32_t)product0;
+			c0 = n0; c1 = n1; c2 = n2; c3 = n3;
+
+			k0 += 0x9E3779B9u;
+			k1 += 0xBB67AE85u;
+		}
+
+		return ((uint64_t)c1 << 32u) | c0;
+	}
+};
+
+#if defined(CHIP8_RANDOM_PHILOX)
+typedef PhiloxRandom Chip8Random;
+#else
+typedef SplitMixRandom Chip8Random;
+#endif
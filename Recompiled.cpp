@@ -0,0 +1,195 @@
+#include "Recompiled.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+
+Chip8Recompiled::Machine::Machine(Chip8& chip, uint8_t const* covered, bool& modified)
+	: chip(chip), V(chip.registers), memory(chip.memory), stack(chip.stack), I(chip.index), pc(chip.pc),
+	sp(chip.sp), delay(chip.delay), sound(chip.sound), covered(covered), modified(modified)
+{
+}
+
+void Chip8Recompiled::Machine::Op(uint16_t opcode)
+{
+	chip.opcode = opcode;
+	Chip8::flatTable[opcode](chip);
+	//a write to memory a fork shares moves it to a copy of its own
+	memory = chip.memory;
+
+	//FX33 and FX55 are the only instructions that write to memory.
+	//if they hit code we translated, the translation is wrong from now on
+	unsigned int first = 0;
+	unsigned int last = 0;
+
+	if ((opcode & 0xF0FFu) == 0xF033u)
+	{
+		first = I;
+		last = I + 2u;
+	}
+	else if ((opcode & 0xF0FFu) == 0xF055u)
+	{
+		first = I;
+		last = I + ((opcode & 0x0F00u) >> 8u);
+	}
+	else
+	{
+		return;
+	}
+
+	for (unsigned int address = first; address <= last && address < MEMORY_SIZE; ++address)
+	{
+		if (covered[address])
+		{
+			modified = true;
+			return;
+		}
+	}
+}
+
+Chip8Recompiled::Chip8Recompiled(Program const& program) : program(program)
+{
+	for (size_t i = 0; i < program.blockCount; ++i)
+	{
+		Block const& block = program.blocks[i];
+		blocks[block.address] = block.code;
+		lengths[block.address] = block.length;
+
+		for (unsigned int offset = 0; offset < 2u * block.length; ++offset)
+		{
+			covered[block.address + offset] = 1;
+		}
+	}
+}
+
+bool Chip8Recompiled::Load(Chip8& chip) const
+{
+	return chip.LoadROM(program.rom, program.romSize);
+}
+
+uint64_t Chip8Recompiled::Run(Chip8& chip, uint64_t cycles)
+{
+	Machine m(chip, covered, modified);
+	uint64_t done = 0;
+	uint64_t translated = 0;
+
+	while (done < cycles)
+	{
+		uint16_t pc = chip.pc;
+
+		//same rule as the JIT: a block always runs to its end, so close to the
+		//end of the budget we go one instruction at a time
+		if (!modified && pc < MEMORY_SIZE && blocks[pc] != nullptr && lengths[pc] <= cycles - done)
+		{
+			uint16_t length = lengths[pc];
+			blocks[pc](m);
+			done += length;
+			translated += length;
+			continue;
+		}
+
+		uint16_t opcode = (chip.memory[pc] << 8u) | chip.memory[pc + 1];
+		chip.pc += 2;
+		m.Op(opcode);
+		++done;
+	}
+
+	return translated;
+}
+
+int Chip8Recompiled::Main(Program const& program, int argc, char* argv[])
+{
+	uint64_t cycles = 100000;
+	uint64_t cyclesPerFrame = 10;
+	bool interpret = false;
+	//a fixed seed like headless, so the output of a CXKK ROM is the same every
+	//run and the translated code can be compared with --interpret
+	uint64_t seed = 0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--interpret") == 0)
+		{
+			interpret = true;
+		}
+		else if (std::strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+		{
+			cycles = std::stoull(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--ipf") == 0 && i + 1 < argc)
+		{
+			cyclesPerFrame = std::max<uint64_t>(1, std::stoull(argv[++i]));
+		}
+		else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+		{
+			seed = std::stoull(argv[++i]);
+		}
+		else
+		{
+			std::fprintf(stderr, "Usage: %s [--cycles N] [--ipf N] [--seed N] [--interpret]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	Chip8 chip8(seed);
+	Chip8Recompiled recompiled(program);
+
+	if (!recompiled.Load(chip8))
+	{
+		std::fprintf(stderr, "%s does not fit in memory\n", program.name);
+		return EXIT_FAILURE;
+	}
+
+	chip8.SetDispatch(Dispatch::Decoded);
+
+	//timers tick once per 60 Hz frame of cyclesPerFrame instructions, like the headless runner
+	auto startTime = std::chrono::steady_clock::now();
+	uint64_t translated = 0;
+	for (uint64_t done = 0; done < cycles;)
+	{
+		uint64_t frameCycles = std::min(cyclesPerFrame, cycles - done);
+
+		if (interpret)
+		{
+			chip8.Run(frameCycles);
+		}
+		else
+		{
+			translated += recompiled.Run(chip8, frameCycles);
+		}
+
+		done += frameCycles;
+		if (frameCycles == cyclesPerFrame)
+		{
+			chip8.TickTimers();
+		}
+	}
+	auto endTime = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+	//64 bit FNV-1a of the framebuffer, same as the headless runner
+	uint64_t hash = 0xCBF29CE484222325ull;
+	uint8_t const* bytes = reinterpret_cast<uint8_t const*>(chip8.video);
+	for (size_t i = 0; i < sizeof(chip8.video); ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ull;
+	}
+
+	std::printf("%s hash=%016llx pc=0x%03X I=0x%03X sp=%u dt=%u st=%u V=", program.name, (unsigned long long)hash,
+		chip8.GetPC(), chip8.GetIndex(), chip8.GetSP(), chip8.GetDelay(), chip8.GetSound());
+	for (unsigned int i = 0; i < REGISTER_COUNT; ++i)
+	{
+		std::printf(i == 0 ? "%02X" : ",%02X", chip8.GetRegisters()[i]);
+	}
+	std::printf("\n");
+
+	std::fprintf(stderr, "%llu instructions (%llu translated) in %.3f s, %.1f M instructions/s\n",
+		(unsigned long long)cycles, (unsigned long long)translated, seconds,
+		seconds > 0.0 ? cycles / seconds / 1e6 : 0.0);
+
+	return EXIT_SUCCESS;
+}
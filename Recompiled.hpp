@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "Chip8.hpp"
+
+//runtime support for ROMs translated to C++ by the static recompiler (recompile.cpp).
+//the generated file has one function per basic block that was reachable from
+//0x200, plus a table of those blocks. Run() calls the block for the current pc
+//when there is one, and falls back to running single instructions when there
+//isnt (00EE and BNNN targets nobody could see ahead of time, code that only
+//exists at runtime, or any code after the ROM wrote over its own instructions).
+class Chip8Recompiled
+{
+public:
+	//the view of the machine the generated code works on
+	struct Machine
+	{
+		Machine(Chip8& chip, uint8_t const* covered, bool& modified);
+
+		//run one instruction with its normal OP_* handler.
+		//pc has to already point past it
+		void Op(uint16_t opcode);
+
+		Chip8& chip;
+		uint8_t* V;
+		uint8_t* memory;
+		uint16_t* stack;
+		uint16_t& I;
+		uint16_t& pc;
+		uint8_t& sp;
+		uint8_t& delay;
+		uint8_t& sound;
+		uint8_t const* covered;	//1 for every byte some block was translated from
+		bool& modified;	//set once the ROM writes into translated code
+	};
+
+	typedef void (*BlockFunc)(Machine& m);
+
+	struct Block
+	{
+		uint16_t address;
+		uint16_t length;	//number of CHIP-8 instructions
+		BlockFunc code;
+	};
+
+	struct Program
+	{
+		char const* name;
+		uint8_t const* rom;
+		size_t romSize;
+		Block const* blocks;
+		size_t blockCount;
+	};
+
+	explicit Chip8Recompiled(Program const& program);
+
+	//load the ROM of the program into chip
+	bool Load(Chip8& chip) const;
+
+	//run exactly "cycles" instructions. returns how many of them ran inside translated blocks
+	uint64_t Run(Chip8& chip, uint64_t cycles);
+
+	//a tiny main for the per ROM binaries: runs the ROM headless and prints
+	//the same kind of result line as the headless runner
+	static int Main(Program const& program, int argc, char* argv[]);
+
+private:
+	Program const& program;
+	BlockFunc blocks[MEMORY_SIZE]{};
+	uint16_t lengths[MEMORY_SIZE]{};
+	uint8_t covered[MEMORY_SIZE]{};
+	bool modified{};
+};
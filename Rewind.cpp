@@ -0,0 +1,213 @@
+#include "Rewind.hpp"
+#include <cstring>
+
+
+//the run length format is a list of (zero run, literal run, literal bytes),
+//both run lengths as LEB128 style varints. XOR deltas are mostly zeroes,
+//so a typical frame is a few long zero runs with short literals in between.
+void PutVarint(std::vector<uint8_t>& out, size_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back((uint8_t)(value | 0x80u));
+		value >>= 7u;
+	}
+	out.push_back((uint8_t)value);
+}
+
+size_t GetVarint(uint8_t const*& data)
+{
+	size_t value = 0;
+	unsigned int shift = 0;
+
+	while (*data & 0x80u)
+	{
+		value |= (size_t)(*data++ & 0x7Fu) << shift;
+		shift += 7;
+	}
+	value |= (size_t)*data++ << shift;
+
+	return value;
+}
+
+//compress a XOR b (or just a, when b is null)
+void Encode(uint8_t const* a, uint8_t const* b, size_t size, std::vector<uint8_t>& out)
+{
+	out.clear();
+
+	size_t i = 0;
+	while (i < size)
+	{
+		size_t zeroStart = i;
+		while (i < size && (a[i] ^ (b ? b[i] : 0)) == 0)
+		{
+			++i;
+		}
+
+		//a literal run ends at the first pair of zeroes, a single zero
+		//costs less as a literal than as a new run
+		size_t literalStart = i;
+		while (i < size && ((a[i] ^ (b ? b[i] : 0)) != 0
+			|| (i + 1 < size && (a[i + 1] ^ (b ? b[i + 1] : 0)) != 0)))
+		{
+			++i;
+		}
+
+		PutVarint(out, literalStart - zeroStart);
+		PutVarint(out, i - literalStart);
+		for (size_t j = literalStart; j < i; ++j)
+		{
+			out.push_back(a[j] ^ (b ? b[j] : 0));
+		}
+	}
+}
+
+//XOR the compressed bytes into target (a keyframe is XORed into zeroes)
+void Decode(uint8_t const* data, uint8_t* target, size_t size)
+{
+	size_t i = 0;
+	while (i < size)
+	{
+		i += GetVarint(data);
+		size_t literals = GetVarint(data);
+
+		for (size_t j = 0; j < literals; ++j)
+		{
+			target[i++] ^= *data++;
+		}
+	}
+}
+
+RewindBuffer::RewindBuffer(size_t budgetBytes, unsigned int keyframeInterval)
+	: keyframeInterval(keyframeInterval > 0 ? keyframeInterval : 1)
+{
+	//offsets are 32 bit, a bigger budget than that would be hours of history anyway
+	budgetBytes = budgetBytes < 0xFFFFFFFFu ? budgetBytes : 0xFFFFFFFFu;
+
+	size_t entryCount = budgetBytes / ENTRY_BYTES > 0 ? budgetBytes / ENTRY_BYTES : 1;
+	entries.resize(entryCount);
+	ring.resize(budgetBytes > entryCount * sizeof(Entry) ? budgetBytes - entryCount * sizeof(Entry) : 0);
+
+	scratch.reserve(2 * sizeof(Chip8State));
+}
+
+void RewindBuffer::Push(Chip8State const& state)
+{
+	uint8_t const* current = reinterpret_cast<uint8_t const*>(&state);
+	uint8_t const* previous = reinterpret_cast<uint8_t const*>(&newest);
+
+	if (hasNewest)
+	{
+		//the frame that was newest so far goes into the history,
+		//as the difference to the one that replaces it or as a whole
+		bool keyframe = ++sinceKeyframe >= keyframeInterval;
+		Encode(previous, keyframe ? nullptr : current, sizeof(Chip8State), scratch);
+		Store(scratch, keyframe);
+
+		if (keyframe)
+		{
+			sinceKeyframe = 0;
+		}
+	}
+
+	memcpy(&newest, &state, sizeof(Chip8State));
+	hasNewest = true;
+}
+
+void RewindBuffer::Store(std::vector<uint8_t> const& data, bool keyframe)
+{
+	if (data.size() > ring.size())
+	{
+		//cant ever fit, so the history cant go back past this frame
+		count = 0;
+		writeOffset = 0;
+		return;
+	}
+
+	size_t offset = writeOffset;
+	if (offset + data.size() > ring.size())
+	{
+		//doesnt fit in front of the end of the ring, start over at 0.
+		//whatever is left behind the write position is the oldest history
+		while (count > 0 && At(0).offset >= writeOffset)
+		{
+			DropOldest();
+		}
+		offset = 0;
+	}
+
+	//drop the oldest frames that are in the way
+	while (count > 0 && At(0).offset < offset + data.size()
+		&& At(0).offset + At(0).size > offset)
+	{
+		DropOldest();
+	}
+
+	//and the oldest one when there is no entry left for this one
+	if (count == entries.size())
+	{
+		DropOldest();
+	}
+
+	memcpy(&ring[offset], data.data(), data.size());
+	At(count++) = Entry{ (uint32_t)offset, (uint32_t)data.size(), keyframe };
+	writeOffset = offset + data.size();
+}
+
+bool RewindBuffer::Rewind(size_t frames, Chip8State& state)
+{
+	if (frames == 0 || frames > count)
+	{
+		return false;
+	}
+
+	size_t target = count - frames;
+
+	//start from the closest keyframe at or after the target (or the newest frame)
+	//and walk back from there, so we never apply more than keyframeInterval deltas
+	size_t start = target;
+	while (start < count && !At(start).keyframe)
+	{
+		++start;
+	}
+
+	uint8_t* bytes = reinterpret_cast<uint8_t*>(&newest);
+	if (start < count)
+	{
+		memset(bytes, 0, sizeof(Chip8State));
+		Decode(&ring[At(start).offset], bytes, sizeof(Chip8State));
+	}
+
+	for (size_t i = start; i > target; --i)
+	{
+		Decode(&ring[At(i - 1).offset], bytes, sizeof(Chip8State));
+	}
+
+	count = target;
+	writeOffset = count == 0 ? 0 : At(count - 1).offset + At(count - 1).size;
+	//the keyframe after the target is gone, so the frames before it chain up to
+	//whatever comes next. that has to be a keyframe, or the next rewind could
+	//walk back through up to twice keyframeInterval deltas
+	sinceKeyframe = keyframeInterval - 1;
+
+	memcpy(&state, &newest, sizeof(Chip8State));
+	return true;
+}
+
+void RewindBuffer::Clear()
+{
+	count = 0;
+	writeOffset = 0;
+	sinceKeyframe = 0;
+	hasNewest = false;
+}
+
+size_t RewindBuffer::BytesUsed() const
+{
+	size_t used = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		used += entries[(first + i) % entries.size()].size;
+	}
+	return used;
+}
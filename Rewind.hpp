@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Chip8.hpp"
+
+
+//history of the last few minutes of frames, so a player can step back in time.
+//
+//only the newest state is kept whole. every older frame is stored as the XOR
+//between it and the frame after it, run length compressed. most frames only
+//change a handful of registers and screen rows, so an entry is a few dozen
+//bytes instead of a whole Chip8State. stepping back one frame is one XOR.
+//every keyframeInterval frames a whole state is stored instead, so jumping
+//back a long way never has to apply more than keyframeInterval deltas.
+//
+//budgetBytes is all the history ever takes: the compressed frames live in one
+//ring of bytes and their entries (where, how big) in a fixed ring of their own,
+//one entry for every ENTRY_BYTES of budget. when either is full the oldest
+//frames are dropped. after the constructor nothing gets allocated.
+class RewindBuffer
+{
+public:
+	explicit RewindBuffer(size_t budgetBytes = 4 * 1024 * 1024, unsigned int keyframeInterval = 60);
+
+	//call once per frame with the state at the end of the frame
+	void Push(Chip8State const& state);
+
+	//go back "frames" frames from the newest one. state gets that frame, which
+	//becomes the newest one (everything after it is gone). false if the history
+	//doesnt go back that far, state is left alone then
+	bool Rewind(size_t frames, Chip8State& state);
+	bool StepBack(Chip8State& state) { return Rewind(1, state); }
+
+	void Clear();
+
+	//number of frames we can go back
+	size_t Frames() const { return count; }
+	size_t BytesUsed() const;
+
+private:
+	//budget per entry. a frame that changed nothing is only 3 bytes, the
+	//entries would outgrow the frames if every byte of budget could be one
+	static const size_t ENTRY_BYTES = 64;
+
+	struct Entry
+	{
+		uint32_t offset;	//where in the ring
+		uint32_t size : 31;	//compressed size
+		uint32_t keyframe : 1;	//whole state instead of a delta to the next frame
+	};
+
+	void Store(std::vector<uint8_t> const& data, bool keyframe);
+
+	//entry i of the history, 0 is the oldest
+	Entry& At(size_t i) { return entries[(first + i) % entries.size()]; }
+	void DropOldest() { first = (first + 1) % entries.size(); --count; }
+
+	std::vector<uint8_t> ring;
+	size_t writeOffset{};
+	std::vector<Entry> entries;	//a ring, count of them starting at first
+	size_t first{};
+	size_t count{};
+
+	unsigned int keyframeInterval;
+	unsigned int sinceKeyframe{};
+
+	Chip8State newest;
+	bool hasNewest{};
+
+	std::vector<uint8_t> scratch;
+};
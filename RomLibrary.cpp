@@ -0,0 +1,296 @@
+#include "RomLibrary.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+const unsigned int MAX_ROM_SIZE = MEMORY_SIZE - START_ADDRESS;
+
+RomLibrary::~RomLibrary()
+{
+	for (Mapping const& mapping : mappings)
+	{
+		Unmap(mapping);
+	}
+}
+
+bool RomLibrary::Map(char const* filename, Mapping& mapping)
+{
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	HANDLE view = nullptr;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+	{
+		view = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	}
+	CloseHandle(file);
+
+	if (view == nullptr)
+	{
+		return false;
+	}
+
+	//the view keeps the mapping alive, the handles are not needed any more
+	mapping.address = MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0);
+	mapping.size = (size_t)size.QuadPart;
+	CloseHandle(view);
+	return mapping.address != nullptr;
+#else
+	int file = open(filename, O_RDONLY);
+	if (file < 0)
+	{
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(file, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size <= 0)
+	{
+		close(file);
+		return false;
+	}
+
+	void* address = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+
+	if (address == MAP_FAILED)
+	{
+		return false;
+	}
+
+	mapping.address = address;
+	mapping.size = (size_t)info.st_size;
+	return true;
+#endif
+}
+
+void RomLibrary::Unmap(Mapping const& mapping)
+{
+#if defined(_WIN32)
+	UnmapViewOfFile(mapping.address);
+#else
+	munmap(mapping.address, mapping.size);
+#endif
+}
+
+//64 bit FNV-1a, the same hash headless uses for the framebuffer
+uint64_t HashRom(uint8_t const* data, size_t size)
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= data[i];
+		hash *= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+RomImage const* RomLibrary::Add(std::string const& name, uint8_t const* data, size_t size)
+{
+	uint64_t hash = HashRom(data, size);
+
+	auto known = byHash.find(hash);
+	if (known != byHash.end())
+	{
+		return &images[known->second];
+	}
+
+	RomImage rom;
+	rom.hash = hash;
+	rom.name = name;
+	rom.data = data;
+	rom.size = (uint32_t)size;
+	if (!Chip8::MakeImage(data, size, rom.image))
+	{
+		return nullptr;
+	}
+
+	byHash[hash] = images.size();
+	images.push_back(rom);
+	return &images.back();
+}
+
+RomImage const* RomLibrary::AddFile(char const* filename)
+{
+	Mapping mapping;
+	if (!Map(filename, mapping))
+	{
+		return nullptr;
+	}
+
+	if (mapping.size > MAX_ROM_SIZE)
+	{
+		Unmap(mapping);
+		return nullptr;
+	}
+
+	size_t before = images.size();
+	RomImage const* rom = Add(std::filesystem::path(filename).filename().string(),
+		static_cast<uint8_t const*>(mapping.address), mapping.size);
+
+	//a ROM we already had points into the file it came from first
+	if (images.size() == before)
+	{
+		Unmap(mapping);
+	}
+	else
+	{
+		mappings.push_back(mapping);
+	}
+
+	return rom;
+}
+
+bool RomLibrary::AddDirectory(char const* directory, std::vector<RomImage const*>& found)
+{
+	std::error_code error;
+	std::vector<std::string> filenames;
+
+	for (std::filesystem::directory_iterator entry(directory, error), end; !error && entry != end; entry.increment(error))
+	{
+		if (entry->is_regular_file(error))
+		{
+			filenames.push_back(entry->path().string());
+		}
+	}
+
+	if (error)
+	{
+		return false;
+	}
+
+	std::sort(filenames.begin(), filenames.end());
+
+	for (std::string const& filename : filenames)
+	{
+		RomImage const* rom = AddFile(filename.c_str());
+		if (rom != nullptr)
+		{
+			found.push_back(rom);
+		}
+	}
+
+	return true;
+}
+
+uint16_t GetU16(uint8_t const* bytes)
+{
+	return (uint16_t)(bytes[0] | (bytes[1] << 8u));
+}
+
+bool RomLibrary::AddPack(char const* filename, std::vector<RomImage const*>& found)
+{
+	Mapping mapping;
+	if (!Map(filename, mapping))
+	{
+		return false;
+	}
+
+	uint8_t const* bytes = static_cast<uint8_t const*>(mapping.address);
+	size_t size = mapping.size;
+
+	struct Entry
+	{
+		size_t name;
+		uint16_t nameLength;
+		size_t rom;
+		uint16_t romSize;
+	};
+	std::vector<Entry> entries;
+
+	//check everything first, a broken pack adds nothing
+	bool valid = size >= 12 && memcmp(bytes, "CH8P", 4) == 0 && GetU16(bytes + 4) == ROM_PACK_VERSION;
+	uint32_t count = valid ? (uint32_t)(GetU16(bytes + 8) | (GetU16(bytes + 10) << 16u)) : 0;
+	size_t at = 12;
+
+	for (uint32_t i = 0; valid && i < count; ++i)
+	{
+		Entry entry{};
+		valid = at + 2 <= size;
+		if (valid)
+		{
+			entry.nameLength = GetU16(bytes + at);
+			entry.name = at + 2;
+			at = entry.name + entry.nameLength;
+			valid = at + 2 <= size;
+		}
+		if (valid)
+		{
+			entry.romSize = GetU16(bytes + at);
+			entry.rom = at + 2;
+			at = entry.rom + entry.romSize;
+			valid = at <= size && entry.romSize > 0 && entry.romSize <= MAX_ROM_SIZE;
+		}
+		entries.push_back(entry);
+	}
+
+	if (!valid || at != size)
+	{
+		Unmap(mapping);
+		return false;
+	}
+
+	mappings.push_back(mapping);
+
+	for (Entry const& entry : entries)
+	{
+		std::string name(reinterpret_cast<char const*>(bytes + entry.name), entry.nameLength);
+		found.push_back(Add(name, bytes + entry.rom, entry.romSize));
+	}
+
+	return true;
+}
+
+void PutU16(FILE* out, uint16_t value)
+{
+	uint8_t bytes[2] = { (uint8_t)value, (uint8_t)(value >> 8u) };
+	std::fwrite(bytes, 1, sizeof(bytes), out);
+}
+
+bool RomLibrary::WritePack(char const* filename) const
+{
+	FILE* out = std::fopen(filename, "wb");
+	if (out == nullptr)
+	{
+		return false;
+	}
+
+	uint32_t count = (uint32_t)images.size();
+	std::fwrite("CH8P", 1, 4, out);
+	PutU16(out, ROM_PACK_VERSION);
+	PutU16(out, 0);
+	PutU16(out, (uint16_t)count);
+	PutU16(out, (uint16_t)(count >> 16u));
+
+	for (RomImage const& rom : images)
+	{
+		uint16_t nameLength = (uint16_t)std::min<size_t>(rom.name.size(), 0xFFFF);
+		PutU16(out, nameLength);
+		std::fwrite(rom.name.data(), 1, nameLength, out);
+		PutU16(out, (uint16_t)rom.size);
+		std::fwrite(rom.data, 1, rom.size, out);
+	}
+
+	return std::fclose(out) == 0;
+}
+
+RomImage const* RomLibrary::Find(uint64_t hash) const
+{
+	auto known = byHash.find(hash);
+	return known != byHash.end() ? &images[known->second] : nullptr;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Chip8.hpp"
+
+
+//a set of ROMs that are read once and then handed to any number of machines.
+//ROM files (one by one, a whole directory, or a pack of many ROMs in one file)
+//are memory mapped, checked once when they are added (they have to fit in the
+//program area, a pack has to be complete), and indexed by a hash of their
+//bytes, so the same ROM under two names is only kept once.
+//after that, starting a machine on a ROM doesnt touch the file system or the
+//allocator: Load is one bounded copy into the machine, Share is no copy at all
+//(the machine shares a ready made memory image until it writes, see Chip8::Image).
+//
+//a pack is (little endian):
+//  "CH8P"          magic
+//  u16 version     ROM_PACK_VERSION
+//  u16             0
+//  u32 count
+//  count times:    u16 name length, name, u16 ROM size, ROM bytes
+const uint16_t ROM_PACK_VERSION = 1;
+
+struct RomImage
+{
+	uint64_t hash;	//64 bit FNV-1a of the bytes
+	std::string name;	//file name without the directory, or the name in the pack
+	uint8_t const* data;	//points into the mapped file
+	uint32_t size;
+	Chip8::Image image;	//memory right after loading it, for Share
+};
+
+class RomLibrary
+{
+public:
+	RomLibrary() = default;
+	~RomLibrary();
+
+	RomLibrary(RomLibrary const&) = delete;
+	RomLibrary& operator=(RomLibrary const&) = delete;
+
+	//the ROM in filename. nullptr if it cant be read, is empty or doesnt fit.
+	//a ROM that is already in the library gives the one that is there
+	RomImage const* AddFile(char const* filename);
+	//every file in directory (sorted by name) that is a valid ROM goes into
+	//found. false if the directory cant be read
+	bool AddDirectory(char const* directory, std::vector<RomImage const*>& found);
+	//every ROM of a pack goes into found. false (and nothing added) if the
+	//pack cant be read or is broken in any way
+	bool AddPack(char const* filename, std::vector<RomImage const*>& found);
+
+	//write every ROM of the library into one pack
+	bool WritePack(char const* filename) const;
+
+	size_t Size() const { return images.size(); }
+	RomImage const& operator[](size_t i) const { return images[i]; }
+	RomImage const* Find(uint64_t hash) const;
+
+	//start chip8 on rom, the same as chip8.LoadROM with the file
+	static bool Load(Chip8& chip8, RomImage const& rom) { return chip8.LoadROM(rom.data, rom.size); }
+	static void Share(Chip8& chip8, RomImage const& rom) { chip8.LoadImage(rom.image); }
+
+private:
+	struct Mapping
+	{
+		void* address;
+		size_t size;
+	};
+
+	//map a whole file read only. false for an empty file
+	static bool Map(char const* filename, Mapping& mapping);
+	static void Unmap(Mapping const& mapping);
+	RomImage const* Add(std::string const& name, uint8_t const* data, size_t size);
+
+	std::vector<Mapping> mappings;
+	std::deque<RomImage> images;	//a deque, so the pointers handed out stay valid
+	std::unordered_map<uint64_t, size_t> byHash;
+};
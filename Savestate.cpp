@@ -0,0 +1,163 @@
+#include "Savestate.hpp"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+
+const uint8_t STATE_MAGIC[4] = { 'C', 'H', '8', 'S' };
+const size_t STATE_HEADER_SIZE = 8;
+
+//every multi byte value is written one byte at a time, lowest byte first,
+//so the file is the same on big and little endian machines
+void PutBytes(std::vector<uint8_t>& out, void const* data, size_t size)
+{
+	uint8_t const* bytes = static_cast<uint8_t const*>(data);
+	out.insert(out.end(), bytes, bytes + size);
+}
+
+void PutLE(std::vector<uint8_t>& out, uint64_t value, unsigned int size)
+{
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		out.push_back((uint8_t)(value >> (8u * i)));
+	}
+}
+
+//reads from a buffer and remembers if it ever ran past the end
+struct StateReader
+{
+	uint8_t const* data;
+	size_t size;
+	size_t position;
+	bool failed;
+
+	void GetBytes(void* target, size_t count)
+	{
+		if (count > size - position)
+		{
+			failed = true;
+			memset(target, 0, count);
+			return;
+		}
+
+		memcpy(target, data + position, count);
+		position += count;
+	}
+
+	uint64_t GetLE(unsigned int count)
+	{
+		uint8_t bytes[8]{};
+		GetBytes(bytes, count);
+
+		uint64_t value = 0;
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			value |= (uint64_t)bytes[i] << (8u * i);
+		}
+		return value;
+	}
+};
+
+void WriteState(Chip8State const& state, std::vector<uint8_t>& out)
+{
+	size_t start = out.size();
+	PutBytes(out, STATE_MAGIC, sizeof(STATE_MAGIC));
+	PutLE(out, STATE_VERSION, 2);
+	PutLE(out, 0, 2);	//size, filled in below
+
+	PutBytes(out, state.memory, sizeof(state.memory));
+	PutBytes(out, state.registers, sizeof(state.registers));
+	PutLE(out, state.index, 2);
+	PutLE(out, state.pc, 2);
+	for (uint16_t level : state.stack)
+	{
+		PutLE(out, level, 2);
+	}
+	PutLE(out, state.sp, 1);
+	PutLE(out, state.delay, 1);
+	PutLE(out, state.sound, 1);
+	PutBytes(out, state.keypad, sizeof(state.keypad));
+	for (uint64_t row : state.video)
+	{
+		PutLE(out, row, 8);
+	}
+	PutLE(out, state.randomKey, 8);
+	PutLE(out, state.randomCounter, 8);
+
+	size_t bodySize = out.size() - start - STATE_HEADER_SIZE;
+	out[start + 6] = (uint8_t)bodySize;
+	out[start + 7] = (uint8_t)(bodySize >> 8u);
+}
+
+bool ReadState(uint8_t const* data, size_t size, Chip8State& state)
+{
+	StateReader reader{ data, size, 0, false };
+
+	uint8_t magic[4];
+	reader.GetBytes(magic, sizeof(magic));
+	uint16_t version = (uint16_t)reader.GetLE(2);
+	size_t bodySize = (size_t)reader.GetLE(2);
+
+	if (reader.failed || memcmp(magic, STATE_MAGIC, sizeof(magic)) != 0 || version != STATE_VERSION
+		|| bodySize > size - STATE_HEADER_SIZE)
+	{
+		return false;
+	}
+
+	//anything after the state belongs to someone else
+	reader.size = STATE_HEADER_SIZE + bodySize;
+
+	//read into a copy, so a bad file leaves the state alone
+	Chip8State loaded;
+	reader.GetBytes(loaded.memory, sizeof(loaded.memory));
+	reader.GetBytes(loaded.registers, sizeof(loaded.registers));
+	loaded.index = (uint16_t)reader.GetLE(2);
+	loaded.pc = (uint16_t)reader.GetLE(2);
+	for (uint16_t& level : loaded.stack)
+	{
+		level = (uint16_t)reader.GetLE(2);
+	}
+	loaded.sp = (uint8_t)reader.GetLE(1);
+	loaded.delay = (uint8_t)reader.GetLE(1);
+	loaded.sound = (uint8_t)reader.GetLE(1);
+	reader.GetBytes(loaded.keypad, sizeof(loaded.keypad));
+	for (uint64_t& row : loaded.video)
+	{
+		row = reader.GetLE(8);
+	}
+
+	loaded.randomKey = reader.GetLE(8);
+	loaded.randomCounter = reader.GetLE(8);
+
+	if (reader.failed || loaded.pc >= MEMORY_SIZE - 1 || loaded.sp > STACK_LEVELS)
+	{
+		return false;
+	}
+
+	state = loaded;
+	return true;
+}
+
+bool SaveStateFile(char const* filename, Chip8State const& state)
+{
+	std::vector<uint8_t> bytes;
+	WriteState(state, bytes);
+
+	std::ofstream file(filename, std::ios::binary);
+	file.write(reinterpret_cast<char const*>(bytes.data()), bytes.size());
+
+	return file.good();
+}
+
+bool LoadStateFile(char const* filename, Chip8State& state)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	return ReadState(bytes.data(), bytes.size(), state);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Chip8.hpp"
+
+
+//on disk savestates.
+//the layout is fixed and little endian no matter what machine wrote it:
+//
+//  "CH8S"          magic
+//  u16 version     STATE_VERSION
+//  u16 size        number of bytes that follow the header
+//  memory, registers, index, pc, stack, sp, delay, sound, keypad, video
+//  u64 random key, u64 random counter
+//
+//ReadState refuses files with a different magic or another version, and
+//anything that would put the machine in a broken state (pc or sp out of range).
+//version 1 stored a std::default_random_engine, which has nothing in common
+//with the counter based generators, so those files cant be read anymore
+const uint16_t STATE_VERSION = 2;
+
+void WriteState(Chip8State const& state, std::vector<uint8_t>& out);
+bool ReadState(uint8_t const* data, size_t size, Chip8State& state);
+
+bool SaveStateFile(char const* filename, Chip8State const& state);
+bool LoadStateFile(char const* filename, Chip8State& state);
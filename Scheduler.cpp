@@ -0,0 +1,69 @@
+#include "Scheduler.hpp"
+#include <thread>
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+
+//how long before the deadline we stop sleeping and start spinning.
+//covers the usual wake up latency of the OS scheduler
+const std::chrono::microseconds SPIN_TIME(500);
+
+//if we fall this many frames behind (window dragged, debugger, slow machine)
+//we dont try to catch up, we just carry on from now
+const int MAX_FRAMES_BEHIND = 4;
+
+FrameScheduler::FrameScheduler(unsigned int framesPerSecond)
+	: framePeriod(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / framesPerSecond)))
+{
+	Reset();
+}
+
+void FrameScheduler::Reset()
+{
+	nextFrame = Clock::now() + framePeriod;
+}
+
+void FrameScheduler::WaitForNextFrame()
+{
+	SleepUntil(nextFrame);
+
+	//deadlines are absolute, so the time spent emulating and presenting
+	//doesnt make the frames drift
+	nextFrame += framePeriod;
+
+	if (Clock::now() > nextFrame + MAX_FRAMES_BEHIND * framePeriod)
+	{
+		Reset();
+	}
+}
+
+void FrameScheduler::SleepUntil(Clock::time_point deadline)
+{
+	Clock::time_point wakeUp = deadline - SPIN_TIME;
+
+#if defined(__linux__)
+	//steady_clock is CLOCK_MONOTONIC here, so its time points can be passed straight
+	//to clock_nanosleep. an absolute deadline doesnt drift when a sleep gets interrupted
+	auto sinceEpoch = std::chrono::duration_cast<std::chrono::nanoseconds>(wakeUp.time_since_epoch());
+	timespec wakeUpTime;
+	wakeUpTime.tv_sec = (time_t)(sinceEpoch.count() / 1000000000);
+	wakeUpTime.tv_nsec = (long)(sinceEpoch.count() % 1000000000);
+
+	while (Clock::now() < wakeUp && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeUpTime, nullptr) != 0)
+	{
+	}
+#else
+	if (Clock::now() < wakeUp)
+	{
+		std::this_thread::sleep_until(wakeUp);
+	}
+#endif
+
+	//the last bit, spin so we dont oversleep
+	while (Clock::now() < deadline)
+	{
+		std::this_thread::yield();
+	}
+}
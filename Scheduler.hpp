@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+
+//paces the emulator loop to a fixed frame rate (60 Hz for CHIP-8).
+//WaitForNextFrame sleeps until the next frame is due instead of busy waiting,
+//so an idle emulator costs almost no CPU. the OS usually wakes us up a bit
+//late, so it sleeps until just before the deadline and spins the last stretch.
+class FrameScheduler
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	explicit FrameScheduler(unsigned int framesPerSecond = 60);
+
+	//blocks until the next frame is due
+	void WaitForNextFrame();
+
+	//start counting frames from now, e.g. after the emulator was paused
+	void Reset();
+
+	Clock::duration FramePeriod() const { return framePeriod; }
+
+private:
+	void SleepUntil(Clock::time_point deadline);
+
+	Clock::duration framePeriod;
+	Clock::time_point nextFrame;
+};
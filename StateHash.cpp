@@ -0,0 +1,84 @@
+#include "StateHash.hpp"
+
+
+TranspositionTable::TranspositionTable(size_t count)
+{
+	size_t buckets = 1;
+	while (buckets * WAYS < count)
+	{
+		buckets *= 2;
+	}
+
+	mask = buckets - 1;
+	entries.reset(new Entry[buckets * WAYS]());
+}
+
+bool TranspositionTable::Find(uint64_t hash, uint32_t& value) const
+{
+	hash = hash != 0 ? hash : 1;
+	Entry const* bucket = Bucket(hash);
+
+	for (size_t way = 0; way < WAYS; ++way)
+	{
+		if (bucket[way].hash == hash)
+		{
+			value = bucket[way].value;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void TranspositionTable::Insert(uint64_t hash, uint32_t value)
+{
+	hash = hash != 0 ? hash : 1;
+	Entry* bucket = Bucket(hash);
+	Entry* slot = &bucket[0];
+
+	for (size_t way = 0; way < WAYS; ++way)
+	{
+		if (bucket[way].hash == hash)
+		{
+			bucket[way].value = value;
+			return;
+		}
+
+		//an empty entry has age 0, so it is always the first pick
+		if (bucket[way].hash == 0 || bucket[way].age < slot->age)
+		{
+			slot = &bucket[way];
+			if (slot->hash == 0)
+			{
+				break;
+			}
+		}
+	}
+
+	slot->hash = hash;
+	slot->value = value;
+	slot->age = ++clock;
+	++inserted;
+}
+
+bool TranspositionTable::Visit(uint64_t hash, uint32_t& value)
+{
+	if (Find(hash, value))
+	{
+		return true;
+	}
+
+	Insert(hash, value);
+	return false;
+}
+
+void TranspositionTable::Clear()
+{
+	for (size_t i = 0; i < Capacity(); ++i)
+	{
+		entries[i] = Entry{};
+	}
+
+	clock = 0;
+	inserted = 0;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "Random.hpp"
+
+
+//hashing whole machine states, for search (was this position seen already?)
+//and for noticing a ROM that is stuck in a loop.
+//
+//memory and the screen are Zobrist hashed: every (address, byte) pair and
+//every pixel that is on has its own random key and the hash is all of them
+//XORed together. a write takes the key of the old value out and puts the key
+//of the new value in, so Chip8 keeps both hashes up to date as FX33/FX55/DXYN/00E0
+//run and never has to look at the other 4 KB again. the key of a 0 is 0, so a
+//fresh machine only has to hash the font.
+//the registers, I, pc, stack and timers are small and change all the time,
+//they are hashed when Chip8::StateHash() is asked for.
+
+//key of byte value at address (0 for a 0 byte). not stored in a table,
+//that would be 8 MB. memory is written rarely, SplitMix is fast enough
+inline uint64_t ZobristByte(unsigned int address, uint8_t value)
+{
+	uint64_t key = SplitMixRandom::Mix((((uint64_t)address << 8u) | value) + 0x6A09E667F3BCC908ull);
+	return value != 0 ? key : 0;
+}
+
+//the screen is XORed into all the time, so its keys are a table.
+//pixel x of row y has the key of column x rotated left by 2 * y, and
+//zobristPixels[lane][byte] is the XOR of the keys of the pixels that are on in
+//byte (the 8 pixels of one lane of a row). the key of a row is the XOR of its
+//8 lanes. being a plain XOR of pixel keys, DXYN can add the key of the sprite
+//row to the hash without knowing what was on the screen before
+inline constexpr std::array<std::array<uint64_t, 256>, 8> zobristPixels = []()
+{
+	std::array<std::array<uint64_t, 256>, 8> table{};
+
+	for (unsigned int lane = 0; lane < 8; ++lane)
+	{
+		for (unsigned int byte = 1; byte < 256; ++byte)
+		{
+			//the left most pixel is the top bit
+			for (unsigned int pixel = 0; pixel < 8; ++pixel)
+			{
+				if ((byte >> (7 - pixel)) & 1u)
+				{
+					table[lane][byte] ^= SplitMixRandom::Mix(lane * 8 + pixel + 0xBB67AE8584CAA73Bull);
+				}
+			}
+		}
+	}
+
+	return table;
+}();
+
+inline uint64_t RotateZobrist(uint64_t key, unsigned int row)
+{
+	unsigned int shift = (2 * row) & 63u;
+	return shift == 0 ? key : (key << shift) | (key >> (64 - shift));
+}
+
+//key of a whole screen row (0 for an empty row)
+inline uint64_t ZobristRow(unsigned int row, uint64_t bits)
+{
+	uint64_t key = 0;
+	for (unsigned int lane = 0; lane < 8; ++lane)
+	{
+		key ^= zobristPixels[lane][(bits >> (56 - 8 * lane)) & 0xFFu];
+	}
+	return RotateZobrist(key, row);
+}
+
+//the same as ZobristRow(row, ((uint64_t)sprite << 56) >> x), one or two lanes
+inline uint64_t ZobristSprite(unsigned int row, unsigned int x, uint8_t sprite)
+{
+	unsigned int lane = x >> 3u;
+	unsigned int shift = x & 7u;
+	uint64_t key = zobristPixels[lane][sprite >> shift];
+	if (lane < 7)
+	{
+		key ^= zobristPixels[lane + 1][(uint8_t)(sprite << (8 - shift))];
+	}
+	return RotateZobrist(key, row);
+}
+
+//remembers state hashes that were seen before, each with a 32 bit value of
+//the caller's choosing (a frame number, a search depth, a score, ...).
+//fixed size, it never allocates after construction: each hash has a bucket of
+//4 entries, and when the bucket is full the oldest entry of it is replaced.
+//hashes are 64 bit, two different states give the same hash about once
+//every 2^32 states in one table, which is good enough to find loops and
+//prune searches but not a proof that two states are equal
+class TranspositionTable
+{
+public:
+	//entries is rounded up to a power of two (and at least one bucket)
+	explicit TranspositionTable(size_t entries);
+
+	//true if hash is in the table, value gets what was stored with it
+	bool Find(uint64_t hash, uint32_t& value) const;
+	//store (or overwrite) hash with value
+	void Insert(uint64_t hash, uint32_t value);
+	//Find and Insert in one: true (with the old value) if hash was seen before,
+	//otherwise it is stored with value and false is returned
+	bool Visit(uint64_t hash, uint32_t& value);
+
+	void Clear();
+
+	size_t Capacity() const { return (mask + 1) * WAYS; }
+	//hashes stored since the last Clear, including ones that got replaced
+	uint64_t Inserted() const { return inserted; }
+
+private:
+	static const size_t WAYS = 4;
+
+	struct Entry
+	{
+		uint64_t hash;	//0 = empty, a real 0 hash is stored as 1
+		uint32_t value;
+		uint32_t age;	//when it was inserted, the smallest one gets replaced
+	};
+
+	Entry* Bucket(uint64_t hash) const { return &entries[(hash & mask) * WAYS]; }
+
+	std::unique_ptr<Entry[]> entries;
+	size_t mask{};	//buckets - 1
+	uint32_t clock{};
+	uint64_t inserted{};
+};
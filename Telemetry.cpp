@@ -0,0 +1,176 @@
+#include "Telemetry.hpp"
+#include <cstdio>
+#include <string>
+
+
+//values below 8 get a bucket each, after that every power of two is split
+//into 8 buckets by the 3 bits under the top bit
+unsigned int LatencyHistogram::BucketOf(uint64_t value)
+{
+	if (value < SUB_BUCKETS)
+	{
+		return (unsigned int)value;
+	}
+
+	unsigned int top = 63;
+	while ((value >> top) == 0)
+	{
+		--top;
+	}
+
+	unsigned int bucket = (top - 2) * SUB_BUCKETS + (unsigned int)((value >> (top - 3)) & (SUB_BUCKETS - 1));
+	return bucket < BUCKETS ? bucket : BUCKETS - 1;
+}
+
+uint64_t LatencyHistogram::BucketTop(unsigned int bucket)
+{
+	if (bucket < SUB_BUCKETS)
+	{
+		return bucket;
+	}
+
+	unsigned int top = bucket / SUB_BUCKETS + 2;
+	uint64_t bottom = (uint64_t)(SUB_BUCKETS + bucket % SUB_BUCKETS) << (top - 3);
+	return bottom + ((uint64_t)1 << (top - 3)) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t nanoseconds)
+{
+	buckets[BucketOf(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+	uint64_t seen = max.load(std::memory_order_relaxed);
+	while (nanoseconds > seen && !max.compare_exchange_weak(seen, nanoseconds, std::memory_order_relaxed))
+	{
+	}
+}
+
+uint64_t LatencyHistogram::Percentile(double fraction) const
+{
+	uint64_t total = Count();
+	if (total == 0)
+	{
+		return 0;
+	}
+
+	//the rank of the recording we are looking for, 1 based
+	uint64_t rank = (uint64_t)(fraction * total + 0.5);
+	rank = rank < 1 ? 1 : rank > total ? total : rank;
+
+	uint64_t seen = 0;
+	for (unsigned int bucket = 0; bucket < BUCKETS; ++bucket)
+	{
+		seen += buckets[bucket].load(std::memory_order_relaxed);
+		if (seen >= rank)
+		{
+			//the top of the last bucket can be way past anything that was recorded
+			uint64_t top = BucketTop(bucket);
+			return top < Max() ? top : Max();
+		}
+	}
+
+	return Max();
+}
+
+void LatencyHistogram::Reset()
+{
+	for (std::atomic<uint64_t>& bucket : buckets)
+	{
+		bucket.store(0, std::memory_order_relaxed);
+	}
+	count.store(0, std::memory_order_relaxed);
+	sum.store(0, std::memory_order_relaxed);
+	max.store(0, std::memory_order_relaxed);
+}
+
+FrameTelemetry::FrameTelemetry() : intervalStart(Clock::now())
+{
+}
+
+void FrameTelemetry::Record(FrameStage stage, Clock::duration time)
+{
+	histograms[(int)stage].Record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+}
+
+void FrameTelemetry::RecordInputToPhoton(Clock::duration time)
+{
+	//the key event time is only known to the millisecond, it can look a little later than it was
+	int64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(time).count();
+	inputToPhoton.Record(nanoseconds > 0 ? (uint64_t)nanoseconds : 0);
+}
+
+const char* const stageNames[(int)FrameStage::Count] = { "input", "emulate", "upload", "present", "frame" };
+
+bool FrameTelemetry::Write(char const* filename)
+{
+	Clock::time_point now = Clock::now();
+	double seconds = std::chrono::duration<double>(now - intervalStart).count();
+	uint64_t intervalInstructions = instructions.exchange(0, std::memory_order_relaxed);
+	uint64_t intervalFrames = Histogram(FrameStage::Frame).Count();
+
+	totalInstructions += intervalInstructions;
+	totalFrames += intervalFrames;
+
+	std::string temporary = std::string(filename) + ".tmp";
+	FILE* out = std::fopen(temporary.c_str(), "w");
+	if (out == nullptr)
+	{
+		return false;
+	}
+
+	std::fprintf(out, "# HELP chip8_stage_seconds time spent in each stage of a frame, over the last %.3f s\n", seconds);
+	std::fprintf(out, "# TYPE chip8_stage_seconds summary\n");
+	for (int stage = 0; stage < (int)FrameStage::Count; ++stage)
+	{
+		LatencyHistogram& histogram = histograms[stage];
+		char const* name = stageNames[stage];
+
+		std::fprintf(out, "chip8_stage_seconds{stage=\"%s\",quantile=\"0.5\"} %.9f\n", name, histogram.Percentile(0.5) / 1e9);
+		std::fprintf(out, "chip8_stage_seconds{stage=\"%s\",quantile=\"0.99\"} %.9f\n", name, histogram.Percentile(0.99) / 1e9);
+		std::fprintf(out, "chip8_stage_seconds{stage=\"%s\",quantile=\"1\"} %.9f\n", name, histogram.Max() / 1e9);
+		std::fprintf(out, "chip8_stage_seconds_sum{stage=\"%s\"} %.9f\n", name, histogram.Sum() / 1e9);
+		std::fprintf(out, "chip8_stage_seconds_count{stage=\"%s\"} %llu\n", name, (unsigned long long)histogram.Count());
+
+		histogram.Reset();
+	}
+
+	std::fprintf(out, "# HELP chip8_input_to_photon_seconds time from a key event until the first frame that saw it was presented\n");
+	std::fprintf(out, "# TYPE chip8_input_to_photon_seconds summary\n");
+	std::fprintf(out, "chip8_input_to_photon_seconds{quantile=\"0.5\"} %.9f\n", inputToPhoton.Percentile(0.5) / 1e9);
+	std::fprintf(out, "chip8_input_to_photon_seconds{quantile=\"0.99\"} %.9f\n", inputToPhoton.Percentile(0.99) / 1e9);
+	std::fprintf(out, "chip8_input_to_photon_seconds{quantile=\"1\"} %.9f\n", inputToPhoton.Max() / 1e9);
+	std::fprintf(out, "chip8_input_to_photon_seconds_sum %.9f\n", inputToPhoton.Sum() / 1e9);
+	std::fprintf(out, "chip8_input_to_photon_seconds_count %llu\n", (unsigned long long)inputToPhoton.Count());
+	inputToPhoton.Reset();
+
+	std::fprintf(out, "# TYPE chip8_instructions_per_second gauge\n");
+	std::fprintf(out, "chip8_instructions_per_second %.0f\n", seconds > 0.0 ? intervalInstructions / seconds : 0.0);
+	std::fprintf(out, "# TYPE chip8_frames_per_second gauge\n");
+	std::fprintf(out, "chip8_frames_per_second %.2f\n", seconds > 0.0 ? intervalFrames / seconds : 0.0);
+	std::fprintf(out, "# TYPE chip8_instructions_total counter\n");
+	std::fprintf(out, "chip8_instructions_total %llu\n", (unsigned long long)totalInstructions);
+	std::fprintf(out, "# TYPE chip8_frames_total counter\n");
+	std::fprintf(out, "chip8_frames_total %llu\n", (unsigned long long)totalFrames);
+	std::fprintf(out, "# TYPE chip8_frames_dropped_total counter\n");
+	std::fprintf(out, "chip8_frames_dropped_total %llu\n", (unsigned long long)droppedFrames.load(std::memory_order_relaxed));
+	std::fprintf(out, "# TYPE chip8_frames_duplicated_total counter\n");
+	std::fprintf(out, "chip8_frames_duplicated_total %llu\n", (unsigned long long)duplicatedFrames.load(std::memory_order_relaxed));
+
+	intervalStart = now;
+
+	if (std::fclose(out) != 0)
+	{
+		std::remove(temporary.c_str());
+		return false;
+	}
+
+	//rename doesnt replace an existing file on Windows
+	if (std::rename(temporary.c_str(), filename) != 0)
+	{
+		std::remove(filename);
+		return std::rename(temporary.c_str(), filename) == 0;
+	}
+
+	return true;
+}
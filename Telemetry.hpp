@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+
+//timings of the frame loop, so a hitch shows up as a number instead of a feeling.
+//every stage of a frame goes into its own histogram, and Write() puts
+//p50/p99/max of each one plus the instructions per second into a small text
+//file (Prometheus text format) that anything can scrape or just cat.
+
+//log-linear histogram of nanoseconds: 8 buckets per power of two, so any
+//percentile is off by at most 12.5%. Record only does relaxed atomic adds,
+//any thread can record while another one reads, without locks
+class LatencyHistogram
+{
+public:
+	static const unsigned int SUB_BUCKETS = 8;
+	static const unsigned int BUCKETS = 41 * SUB_BUCKETS;	//up to about 2^43 ns (2.4 hours)
+
+	void Record(uint64_t nanoseconds);
+
+	//everything recorded since the last Reset
+	uint64_t Count() const { return count.load(std::memory_order_relaxed); }
+	uint64_t Max() const { return max.load(std::memory_order_relaxed); }
+	uint64_t Sum() const { return sum.load(std::memory_order_relaxed); }
+
+	//the value below which a fraction (0.5 for p50, 0.99 for p99) of the
+	//recordings are, as the upper edge of its bucket. 0 when empty
+	uint64_t Percentile(double fraction) const;
+
+	void Reset();
+
+private:
+	static unsigned int BucketOf(uint64_t value);
+	static uint64_t BucketTop(unsigned int bucket);
+
+	std::atomic<uint64_t> buckets[BUCKETS]{};
+	std::atomic<uint64_t> count{};
+	std::atomic<uint64_t> sum{};
+	std::atomic<uint64_t> max{};
+};
+
+//the parts of one frame of the emulator loop
+enum class FrameStage
+{
+	Input,	//Platform::ReadKeys and the turbo switch
+	Emulate,	//running the instructions (or stepping back while rewinding)
+	Upload,	//SDL_UpdateTexture, on the main thread
+	Present,	//SDL_RenderPresent, includes waiting for vsync (main thread too)
+	Frame,	//start of one frame to the start of the next, includes sleeping
+	Count
+};
+
+class FrameTelemetry
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	FrameTelemetry();
+
+	void Record(FrameStage stage, Clock::duration time);
+	void AddInstructions(uint64_t count) { instructions.fetch_add(count, std::memory_order_relaxed); }
+	//frames that were never presented, and 60 Hz frames it showed an old one for (see Platform)
+	void AddDroppedFrames(uint64_t count) { droppedFrames.fetch_add(count, std::memory_order_relaxed); }
+	void AddDuplicatedFrames(uint64_t count) { duplicatedFrames.fetch_add(count, std::memory_order_relaxed); }
+
+	LatencyHistogram const& Histogram(FrameStage stage) const { return histograms[(int)stage]; }
+
+	//from a key event to the end of the present of the first frame that saw it
+	void RecordInputToPhoton(Clock::duration time);
+	LatencyHistogram const& InputToPhoton() const { return inputToPhoton; }
+
+	//write the numbers of the interval since the last Write to filename and
+	//start a new interval. the file is written next to it and renamed over
+	//it, so a reader never sees half a file. false if it couldnt be written
+	bool Write(char const* filename);
+
+private:
+	LatencyHistogram histograms[(int)FrameStage::Count];
+	LatencyHistogram inputToPhoton;
+	std::atomic<uint64_t> instructions{};
+	std::atomic<uint64_t> droppedFrames{};
+	std::atomic<uint64_t> duplicatedFrames{};
+	uint64_t totalInstructions{};
+	uint64_t totalFrames{};
+	Clock::time_point intervalStart;
+};
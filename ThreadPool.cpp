@@ -0,0 +1,103 @@
+#include "ThreadPool.hpp"
+
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+{
+	if (threadCount == 0)
+	{
+		threadCount = std::thread::hardware_concurrency();
+	}
+
+	if (threadCount == 0)
+	{
+		threadCount = 1;
+	}
+
+	//the thread calling ParallelFor does work too, so we need one less
+	for (unsigned int i = 1; i < threadCount; ++i)
+	{
+		workers.emplace_back(&ThreadPool::Worker, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	wake.notify_all();
+
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
+
+unsigned int ThreadPool::Size() const
+{
+	return (unsigned int)workers.size() + 1;
+}
+
+void ThreadPool::ParallelFor(size_t count, std::function<void(size_t)> const& fn)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &fn;
+		jobCount = count;
+		next = 0;
+		busy = workers.size();
+		++generation;
+	}
+	wake.notify_all();
+
+	//help out instead of just sitting here
+	RunJobs();
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return busy == 0; });
+	job = nullptr;
+}
+
+void ThreadPool::Worker()
+{
+	uint64_t seen = 0;
+
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stop || generation != seen; });
+
+			if (stop)
+			{
+				return;
+			}
+
+			seen = generation;
+		}
+
+		RunJobs();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busy == 0)
+		{
+			done.notify_one();
+		}
+	}
+}
+
+void ThreadPool::RunJobs()
+{
+	//every thread grabs the next index until they are all taken.
+	//one index per grab keeps long and short ROMs balanced
+	for (size_t i = next.fetch_add(1); i < jobCount; i = next.fetch_add(1))
+	{
+		(*job)(i);
+	}
+}
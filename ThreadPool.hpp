@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//a small fixed size pool of worker threads.
+//ParallelFor hands out the indices 0..count-1 to the workers
+//(and to the calling thread) and returns once every index has been run.
+//the threads stay alive between calls so handing out work is cheap.
+class ThreadPool
+{
+public:
+	//threadCount = 0 means one thread per hardware core
+	explicit ThreadPool(unsigned int threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(ThreadPool const&) = delete;
+	ThreadPool& operator=(ThreadPool const&) = delete;
+
+	void ParallelFor(size_t count, std::function<void(size_t)> const& job);
+
+	//number of threads that run jobs, including the caller of ParallelFor
+	unsigned int Size() const;
+
+private:
+	void Worker();
+	void RunJobs();
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	std::function<void(size_t)> const* job{};
+	size_t jobCount{};
+	std::atomic<size_t> next{};
+	size_t busy{};
+	uint64_t generation{};
+	bool stop{};
+};
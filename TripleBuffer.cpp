@@ -0,0 +1,33 @@
+#include "TripleBuffer.hpp"
+
+
+TripleBuffer::TripleBuffer(size_t bytes)
+{
+	for (Slot& slot : slots)
+	{
+		slot.data.reset(new uint8_t[bytes]());
+	}
+}
+
+bool TripleBuffer::Publish(uint64_t frame)
+{
+	slots[back].frame = frame;
+
+	//release: the reader that takes this slot sees everything written to it.
+	//acquire: the slot that comes back is no longer being read
+	uint8_t old = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+	back = old & 3u;
+
+	return (old & FRESH) == 0;
+}
+
+bool TripleBuffer::Take()
+{
+	if (!Fresh())
+	{
+		return false;
+	}
+
+	front = middle.exchange(front, std::memory_order_acq_rel) & 3u;
+	return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+
+//hands finished frames from one thread (the emulator) to another (the
+//renderer) without either of them ever waiting for the other.
+//there are three buffers: the writer fills the back one, the reader shows the
+//front one, and the middle one is the newest finished frame. Publish swaps
+//back and middle, Take swaps middle and front, each with one atomic exchange.
+//the reader always gets the newest frame, a frame that was published again
+//before the reader took it is dropped (and Publish says so).
+//one writer thread and one reader thread, no more
+class TripleBuffer
+{
+public:
+	explicit TripleBuffer(size_t bytes);
+
+	TripleBuffer(TripleBuffer const&) = delete;
+	TripleBuffer& operator=(TripleBuffer const&) = delete;
+
+	//writer: fill Back(), then Publish it. frame is any number the reader
+	//gets back with it (the emulator passes its frame counter)
+	void* Back() { return slots[back].data.get(); }
+	//false if the frame that was published before this one was never taken
+	bool Publish(uint64_t frame);
+
+	//reader: true if a frame was published since the last Take
+	bool Fresh() const { return (middle.load(std::memory_order_acquire) & FRESH) != 0; }
+	//make the newest published frame the front one. false (and the front
+	//stays what it was) if there is nothing new
+	bool Take();
+	void const* Front() const { return slots[front].data.get(); }
+	uint64_t FrontFrame() const { return slots[front].frame; }
+
+private:
+	//set in middle while it holds a frame the reader hasnt taken
+	static const uint8_t FRESH = 4;
+
+	struct Slot
+	{
+		std::unique_ptr<uint8_t[]> data;
+		uint64_t frame{};
+	};
+
+	Slot slots[3];
+	std::atomic<uint8_t> middle{ 1 };
+	uint8_t back{ 0 };	//only touched by the writer
+	uint8_t front{ 2 };	//only touched by the reader
+};
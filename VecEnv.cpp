@@ -0,0 +1,145 @@
+#include "VecEnv.hpp"
+#include <cstring>
+#include "Movie.hpp"
+#include "Random.hpp"
+
+
+Chip8VecEnv::Chip8VecEnv(size_t count, ObservationFormat format, uint64_t cyclesPerFrame, unsigned int threads)
+	: count(count), format(format), cyclesPerFrame(cyclesPerFrame),
+	envs(new Chip8[count]), episodeFrames(count), pool(threads)
+{
+	//a machine with nothing loaded, until LoadROM gives it a program
+	Chip8 chip8(0);
+	chip8.SaveState(powerOn);
+	image = chip8.MemoryImage();
+
+	resetJob = [this](size_t chunk) { ResetChunk(chunk); };
+	stepJob = [this](size_t chunk) { StepChunk(chunk); };
+}
+
+bool Chip8VecEnv::LoadROM(char const* filename)
+{
+	Chip8 chip8(0);
+	if (!chip8.LoadROM(filename))
+	{
+		return false;
+	}
+
+	chip8.SaveState(powerOn);
+	image = chip8.MemoryImage();
+	return true;
+}
+
+bool Chip8VecEnv::LoadROM(uint8_t const* data, size_t size)
+{
+	Chip8 chip8(0);
+	if (!chip8.LoadROM(data, size))
+	{
+		return false;
+	}
+
+	chip8.SaveState(powerOn);
+	image = chip8.MemoryImage();
+	return true;
+}
+
+void Chip8VecEnv::SetDispatch(Dispatch mode)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		envs[i].SetDispatch(mode);
+	}
+}
+
+size_t Chip8VecEnv::ObservationSize() const
+{
+	return format == ObservationFormat::Bits ? sizeof(uint64_t) * VIDEO_HEIGHT : VIDEO_WIDTH * VIDEO_HEIGHT;
+}
+
+void Chip8VecEnv::Reset(uint64_t const* seeds, uint8_t const* which, uint8_t* observations)
+{
+	resetSeeds = seeds;
+	resetWhich = which;
+	stepObservations = observations;
+
+	pool.ParallelFor((count + CHUNK - 1) / CHUNK, resetJob);
+}
+
+void Chip8VecEnv::Step(uint16_t const* actions, uint8_t* observations, float* rewards, uint8_t* dones)
+{
+	stepActions = actions;
+	stepObservations = observations;
+	stepRewards = rewards;
+	stepDones = dones;
+
+	pool.ParallelFor((count + CHUNK - 1) / CHUNK, stepJob);
+}
+
+void Chip8VecEnv::ResetChunk(size_t chunk)
+{
+	size_t end = (chunk + 1) * CHUNK < count ? (chunk + 1) * CHUNK : count;
+	Chip8State state;
+
+	for (size_t i = chunk * CHUNK; i < end; ++i)
+	{
+		if (resetWhich != nullptr && resetWhich[i] == 0)
+		{
+			continue;
+		}
+
+		//only the random numbers differ between the environments,
+		//the same as constructing Chip8(seed) and loading the ROM
+		state = powerOn;
+		state.randomKey = Chip8Random::Key(resetSeeds[i], 0);
+		state.randomCounter = 0;
+		//share the memory first, LoadState then finds nothing to copy
+		envs[i].LoadImage(image);
+		envs[i].LoadState(state);
+		episodeFrames[i] = 0;
+
+		Observe(i, stepObservations);
+	}
+}
+
+void Chip8VecEnv::StepChunk(size_t chunk)
+{
+	size_t end = (chunk + 1) * CHUNK < count ? (chunk + 1) * CHUNK : count;
+
+	for (size_t i = chunk * CHUNK; i < end; ++i)
+	{
+		Chip8& chip8 = envs[i];
+
+		SetKeypad(chip8.keypad, stepActions[i]);
+		chip8.Run(cyclesPerFrame);
+		chip8.TickTimers();
+		++episodeFrames[i];
+
+		bool done = frameLimit != 0 && episodeFrames[i] >= frameLimit;
+		float reward = rewardHook ? rewardHook(i, chip8, done) : 0.0f;
+
+		stepRewards[i] = reward;
+		stepDones[i] = done ? 1 : 0;
+		Observe(i, stepObservations);
+	}
+}
+
+void Chip8VecEnv::Observe(size_t i, uint8_t* observations) const
+{
+	uint64_t const* video = envs[i].video;
+	uint8_t* out = observations + i * ObservationSize();
+
+	if (format == ObservationFormat::Bits)
+	{
+		memcpy(out, video, sizeof(uint64_t) * VIDEO_HEIGHT);
+		return;
+	}
+
+	for (unsigned int y = 0; y < VIDEO_HEIGHT; ++y)
+	{
+		uint64_t row = video[y];
+		for (unsigned int x = 0; x < VIDEO_WIDTH; ++x)
+		{
+			out[y * VIDEO_WIDTH + x] = (uint8_t)(0u - (unsigned int)((row >> (VIDEO_WIDTH - 1 - x)) & 1u));
+		}
+	}
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "Chip8.hpp"
+#include "ThreadPool.hpp"
+
+
+//many machines running the same ROM, stepped together one frame at a time.
+//made for training code that runs thousands of environments: every call
+//takes one array of keys and fills arrays of observations, rewards and done
+//flags that the caller owns, environment after environment with no gaps, so
+//they can be handed straight to numpy/torch. a step allocates nothing, the
+//environments are spread over a thread pool in chunks.
+//
+//one step is one 60 Hz frame, the same as the window and PlayMovie: set the
+//keys, run cyclesPerFrame instructions, tick the timers.
+
+//how the screen of an environment is written to the observations
+enum class ObservationFormat
+{
+	Bits,	//1 bit per pixel: 32 rows of uint64_t, left most pixel in the top bit (256 bytes)
+	Bytes,	//1 byte per pixel: 32 rows of 64 bytes, 0 or 0xFF (2048 bytes)
+};
+
+class Chip8VecEnv
+{
+public:
+	//called for every environment after its frame ran, on whichever thread
+	//stepped it. returns the reward of the frame and can set done. it must only
+	//look at (or poke) the machine it is given
+	typedef std::function<float(size_t env, Chip8& chip8, bool& done)> RewardHook;
+
+	//threads = 0 means one thread per hardware core
+	Chip8VecEnv(size_t count, ObservationFormat format, uint64_t cyclesPerFrame = 10, unsigned int threads = 0);
+
+	Chip8VecEnv(Chip8VecEnv const&) = delete;
+	Chip8VecEnv& operator=(Chip8VecEnv const&) = delete;
+
+	//the ROM every environment starts from on Reset
+	bool LoadROM(char const* filename);
+	bool LoadROM(uint8_t const* data, size_t size);
+
+	void SetDispatch(Dispatch mode);
+	void SetRewardHook(RewardHook hook) { rewardHook = hook; }
+	//done is set once an episode has run this many frames. 0 = no limit
+	void SetFrameLimit(uint32_t frames) { frameLimit = frames; }
+
+	size_t Size() const { return count; }
+	//bytes of observations per environment
+	size_t ObservationSize() const;
+
+	//start environment i over with the ROM and the random numbers of
+	//Chip8(seeds[i]). when which is not null only the environments with
+	//which[i] != 0 are reset, so the dones of the last Step can be passed
+	//straight in. the observations of the reset environments are written
+	void Reset(uint64_t const* seeds, uint8_t const* which, uint8_t* observations);
+
+	//run one frame on every environment with actions[i] as its keys
+	//(bit k = key k is held, the same as KeypadMask in Movie.hpp).
+	//observations has Size() * ObservationSize() bytes, rewards and dones
+	//have Size() entries. dones is 1 where the hook or the frame limit ended
+	//the episode, those environments keep running until they are Reset
+	void Step(uint16_t const* actions, uint8_t* observations, float* rewards, uint8_t* dones);
+
+	//for looking at one environment between steps
+	Chip8& Env(size_t i) { return envs[i]; }
+
+private:
+	//environments per job of the thread pool, enough to make handing
+	//out a job cheap next to running it
+	static const size_t CHUNK = 64;
+
+	void ResetChunk(size_t chunk);
+	void StepChunk(size_t chunk);
+	void Observe(size_t i, uint8_t* observations) const;
+
+	size_t count;
+	ObservationFormat format;
+	uint64_t cyclesPerFrame;
+
+	//one block, so stepping walks memory front to back
+	std::unique_ptr<Chip8[]> envs;
+	std::vector<uint32_t> episodeFrames;
+	uint32_t frameLimit{};
+
+	//the machine right after LoadROM, what Reset copies into an environment.
+	//memory is not copied, the environments share image until they write to it
+	Chip8State powerOn{};
+	Chip8::Image image;
+	RewardHook rewardHook;
+
+	//the arguments of the Reset/Step that is running, for the jobs.
+	//the jobs only capture this, so std::function never has to allocate
+	uint64_t const* resetSeeds{};
+	uint8_t const* resetWhich{};
+	uint16_t const* stepActions{};
+	uint8_t* stepObservations{};
+	float* stepRewards{};
+	uint8_t* stepDones{};
+	std::function<void(size_t)> resetJob;
+	std::function<void(size_t)> stepJob;
+
+	ThreadPool pool;
+};
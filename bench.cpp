@@ -0,0 +1,572 @@
+//benchmarks for the CHIP-8 core.
+//micro: every OP_* handler (and the Table0/8/E/F hops) called on its own in a tight loop.
+//macro: a few small synthetic ROMs run headless on every interpreter core,
+//in short frames of 10 instructions with the idle loop check on and off,
+//and in batches of 8, 16 and 32 lanes (Batch.hpp).
+//
+//every result is one line of key=value pairs, so two builds can be compared
+//with --baseline (or with diff / a script):
+//  micro name=8XY4 ns=1.234 net=0.456
+//  macro rom=alu dispatch=jit instructions=50000000 seconds=0.310 ips=161290322 ns=6.200
+//  frame rom=alu dispatch=jit ipf=10 idle=on instructions=20000010 seconds=0.110 ips=181818181 ns=5.500
+//  batch rom=alu lanes=32 instructions=20000000 seconds=0.020 ips=1000000000 ns=1.000
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "Batch.hpp"
+#include "Chip8.hpp"
+
+/***************************************************
+*  Synthetic ROMs                                  *
+*                                                  *
+*  Each one is an endless loop that leans on one   *
+*  kind of work.                                   *
+***************************************************/
+
+struct BenchRom
+{
+	char const* name;
+	std::vector<uint8_t> code;
+};
+
+const BenchRom benchRoms[] =
+{
+	//register math: loads, adds, subtracts, xor, shifts and a skip
+	{ "alu", {
+		0x60, 0x01,	//200: V0 = 1
+		0x61, 0x03,	//202: V1 = 3
+		0x80, 0x14,	//204: V0 += V1
+		0x81, 0x05,	//206: V1 -= V0
+		0x82, 0x13,	//208: V2 ^= V1
+		0x80, 0x16,	//20A: V0 >>= 1
+		0x81, 0x1E,	//20C: V1 <<= 1
+		0x70, 0x05,	//20E: V0 += 5
+		0x30, 0x00,	//210: skip if V0 == 0
+		0x12, 0x04,	//212: jump 204
+		0x12, 0x00,	//214: jump 200
+	} },
+	//sprites: font digits drawn all over the screen
+	{ "sprites", {
+		0xA0, 0x50,	//200: I = font 0
+		0xD0, 0x15,	//202: draw 5 rows at V0, V1
+		0x70, 0x03,	//204: V0 += 3
+		0x71, 0x01,	//206: V1 += 1
+		0xF2, 0x29,	//208: I = font V2
+		0x72, 0x01,	//20A: V2 += 1
+		0xD1, 0x05,	//20C: draw 5 rows at V1, V0
+		0x12, 0x02,	//20E: jump 202
+	} },
+	//BCD and memory copies
+	{ "memory", {
+		0xA3, 0x00,	//200: I = 300
+		0xF0, 0x33,	//202: BCD of V0 at I
+		0xF2, 0x65,	//204: V0..V2 = [I]
+		0xF4, 0x55,	//206: [I] = V0..V4
+		0x75, 0x07,	//208: V5 += 7
+		0x80, 0x50,	//20A: V0 = V5
+		0xF3, 0x1E,	//20C: I += V3
+		0x12, 0x00,	//20E: jump 200
+	} },
+	//waiting for a key that never comes: a SKP polling loop
+	{ "keywait", {
+		0xE0, 0x9E,	//200: skip if key V0 is down
+		0x12, 0x00,	//202: jump 200
+	} },
+	//subroutine calls
+	{ "calls", {
+		0x22, 0x04,	//200: call 204
+		0x12, 0x00,	//202: jump 200
+		0x70, 0x01,	//204: V0 += 1
+		0x00, 0xEE,	//206: return
+	} },
+};
+
+struct DispatchName
+{
+	Dispatch mode;
+	char const* name;
+};
+
+const DispatchName dispatchNames[] =
+{
+	{ Dispatch::Table, "table" },
+	{ Dispatch::Switch, "switch" },
+	{ Dispatch::Goto, "goto" },
+	{ Dispatch::Flat, "flat" },
+	{ Dispatch::Decoded, "decoded" },
+	{ Dispatch::Fused, "fused" },
+	{ Dispatch::Jit, "jit" },
+};
+
+struct BenchResult
+{
+	std::string key;	//what the line is about, used to match it with the baseline
+	std::string line;
+	double ns;
+};
+
+/***************************************************
+*  Micro benchmarks                                *
+***************************************************/
+
+class Chip8Bench
+{
+public:
+	static void RunMicro(uint64_t iterations, std::vector<BenchResult>& results);
+
+private:
+	struct Handler
+	{
+		char const* name;
+		uint16_t opcode;
+		Chip8::Chip8Func handler;
+	};
+
+	static double TimeHandler(Chip8::Chip8Func handler, uint16_t opcode, uint64_t iterations);
+};
+
+double Chip8Bench::TimeHandler(Chip8::Chip8Func handler, uint16_t opcode, uint64_t iterations)
+{
+	//go through a volatile so the compiler cant see which handler it is and inline it
+	Chip8::Chip8Func volatile hidden = handler;
+	Chip8::Chip8Func call = hidden;
+
+	Chip8 chip8(0);
+	for (unsigned int i = 0; i < REGISTER_COUNT; ++i)
+	{
+		chip8.registers[i] = (uint8_t)(i * 37u + 5u);
+	}
+
+	//the first call starts where every later one does (a 00EE at sp 0 would
+	//read the stack from below)
+	chip8.pc = START_ADDRESS;
+	chip8.sp = 1;
+	chip8.index = 0x300;
+
+	//best of a few runs, the others were disturbed by something
+	double best = 1e30;
+	for (unsigned int run = 0; run < 5; ++run)
+	{
+		auto startTime = std::chrono::steady_clock::now();
+
+		for (uint64_t i = 0; i < iterations; ++i)
+		{
+			chip8.opcode = opcode;
+			(chip8.*call)();
+
+			//put back what jumps, calls, returns and FX1E move,
+			//so every call does the same work
+			chip8.pc = START_ADDRESS;
+			chip8.sp = 1;
+			chip8.index = 0x300;
+		}
+
+		auto endTime = std::chrono::steady_clock::now();
+		best = std::min(best, std::chrono::duration<double, std::nano>(endTime - startTime).count() / iterations);
+	}
+
+	return best;
+}
+
+void Chip8Bench::RunMicro(uint64_t iterations, std::vector<BenchResult>& results)
+{
+	static const Handler handlers[] =
+	{
+		{ "00E0", 0x00E0, &Chip8::OP_00E0 },
+		{ "00EE", 0x00EE, &Chip8::OP_00EE },
+		{ "1NNN", 0x1200, &Chip8::OP_1NNN },
+		{ "2NNN", 0x2200, &Chip8::OP_2NNN },
+		{ "3XKK", 0x3012, &Chip8::OP_3XKK },
+		{ "4XKK", 0x4012, &Chip8::OP_4XKK },
+		{ "5XY0", 0x5010, &Chip8::OP_5XY0 },
+		{ "6XKK", 0x6012, &Chip8::OP_6XKK },
+		{ "7XKK", 0x7012, &Chip8::OP_7XKK },
+		{ "8XY0", 0x8010, &Chip8::OP_8XY0 },
+		{ "8XY1", 0x8011, &Chip8::OP_8XY1 },
+		{ "8XY2", 0x8012, &Chip8::OP_8XY2 },
+		{ "8XY3", 0x8013, &Chip8::OP_8XY3 },
+		{ "8XY4", 0x8014, &Chip8::OP_8XY4 },
+		{ "8XY5", 0x8015, &Chip8::OP_8XY5 },
+		{ "8XY6", 0x8016, &Chip8::OP_8XY6 },
+		{ "8XY7", 0x8017, &Chip8::OP_8XY7 },
+		{ "8XYE", 0x801E, &Chip8::OP_8XYE },
+		{ "9XY0", 0x9010, &Chip8::OP_9XY0 },
+		{ "ANNN", 0xA300, &Chip8::OP_ANNN },
+		{ "BNNN", 0xB200, &Chip8::OP_BNNN },
+		{ "CXKK", 0xC0FF, &Chip8::OP_CXKK },
+		{ "DXYN", 0xD01F, &Chip8::OP_DXYN },
+		{ "EX9E", 0xE09E, &Chip8::OP_EX9E },
+		{ "EXA1", 0xE0A1, &Chip8::OP_EXA1 },
+		{ "FX07", 0xF007, &Chip8::OP_FX07 },
+		{ "FX0A", 0xF00A, &Chip8::OP_FX0A },
+		{ "FX15", 0xF015, &Chip8::OP_FX15 },
+		{ "FX18", 0xF018, &Chip8::OP_FX18 },
+		{ "FX1E", 0xF01E, &Chip8::OP_FX1E },
+		{ "FX29", 0xF029, &Chip8::OP_FX29 },
+		{ "FX33", 0xF033, &Chip8::OP_FX33 },
+		{ "FX55", 0xFF55, &Chip8::OP_FX55 },
+		{ "FX65", 0xFF65, &Chip8::OP_FX65 },
+		//the second level tables, timed with one of their opcodes.
+		//the difference to that opcode's own line is the cost of the hop
+		{ "Table0:00E0", 0x00E0, &Chip8::Table0 },
+		{ "Table8:8XY4", 0x8014, &Chip8::Table8 },
+		{ "TableE:EX9E", 0xE09E, &Chip8::TableE },
+		{ "TableF:FX1E", 0xF01E, &Chip8::TableF },
+	};
+
+	//the loop itself, the call and the resets. subtracted to get "net"
+	double overhead = TimeHandler(&Chip8::OP_NULL, 0x0000, iterations);
+
+	char line[256];
+	std::snprintf(line, sizeof(line), "micro name=overhead ns=%.3f net=0.000", overhead);
+	results.push_back(BenchResult{ "micro overhead", line, overhead });
+
+	for (Handler const& handler : handlers)
+	{
+		double ns = TimeHandler(handler.handler, handler.opcode, iterations);
+
+		std::snprintf(line, sizeof(line), "micro name=%s ns=%.3f net=%.3f", handler.name, ns, std::max(0.0, ns - overhead));
+		results.push_back(BenchResult{ std::string("micro ") + handler.name, line, ns });
+	}
+}
+
+/***************************************************
+*  Macro benchmarks                                *
+***************************************************/
+
+void RunMacro(uint64_t cycles, std::vector<DispatchName> const& dispatches, std::vector<BenchResult>& results)
+{
+	for (BenchRom const& rom : benchRoms)
+	{
+		for (DispatchName const& dispatch : dispatches)
+		{
+			Chip8 chip8(0);
+			chip8.LoadROM(rom.code.data(), rom.code.size());
+			chip8.SetDispatch(dispatch.mode);
+			//time the core, not the fast-forward past idle loops (RunFrames has that)
+			chip8.SetIdleSkip(false);
+
+			//warm up the caches of the decoded cores and the JIT
+			chip8.Run(cycles / 100 + 1);
+
+			//best of three, the ROMs just keep running from where they were
+			uint64_t ran = 0;
+			double seconds = 1e30;
+			for (unsigned int run = 0; run < 3; ++run)
+			{
+				auto startTime = std::chrono::steady_clock::now();
+				ran = chip8.Run(cycles);
+				auto endTime = std::chrono::steady_clock::now();
+
+				seconds = std::min(seconds, std::chrono::duration<double>(endTime - startTime).count());
+			}
+
+			double ns = ran > 0 ? seconds * 1e9 / ran : 0.0;
+
+			char line[256];
+			std::snprintf(line, sizeof(line), "macro rom=%s dispatch=%s instructions=%llu seconds=%.3f ips=%.0f ns=%.3f",
+				rom.name, dispatch.name, (unsigned long long)ran, seconds, seconds > 0.0 ? ran / seconds : 0.0, ns);
+			results.push_back(BenchResult{ std::string("macro ") + rom.name + " " + dispatch.name, line, ns });
+		}
+	}
+}
+
+//the ROMs again, but run the way a frontend does: FRAME_IPF instructions and
+//a timer tick per frame, with the idle loop check on and off. short runs are
+//where the check costs the most, it runs at the start of every one
+const unsigned int FRAME_IPF = 10;
+
+void RunFrames(uint64_t cycles, std::vector<DispatchName> const& dispatches, std::vector<BenchResult>& results)
+{
+	uint64_t frames = cycles / FRAME_IPF + 1;
+
+	for (BenchRom const& rom : benchRoms)
+	{
+		for (DispatchName const& dispatch : dispatches)
+		{
+			for (bool idleSkip : { true, false })
+			{
+				Chip8 chip8(0);
+				chip8.LoadROM(rom.code.data(), rom.code.size());
+				chip8.SetDispatch(dispatch.mode);
+				chip8.SetIdleSkip(idleSkip);
+
+				for (uint64_t frame = 0; frame < frames / 100 + 1; ++frame)
+				{
+					chip8.Run(FRAME_IPF);
+					chip8.TickTimers();
+				}
+
+				double seconds = 1e30;
+				for (unsigned int run = 0; run < 3; ++run)
+				{
+					auto startTime = std::chrono::steady_clock::now();
+					for (uint64_t frame = 0; frame < frames; ++frame)
+					{
+						chip8.Run(FRAME_IPF);
+						chip8.TickTimers();
+					}
+					auto endTime = std::chrono::steady_clock::now();
+
+					seconds = std::min(seconds, std::chrono::duration<double>(endTime - startTime).count());
+				}
+
+				uint64_t ran = frames * FRAME_IPF;
+				double ns = seconds * 1e9 / ran;
+				char const* idle = idleSkip ? "on" : "off";
+
+				char line[256];
+				std::snprintf(line, sizeof(line), "frame rom=%s dispatch=%s ipf=%u idle=%s instructions=%llu seconds=%.3f ips=%.0f ns=%.3f",
+					rom.name, dispatch.name, FRAME_IPF, idle, (unsigned long long)ran, seconds, seconds > 0.0 ? ran / seconds : 0.0, ns);
+				results.push_back(BenchResult{ std::string("frame ") + rom.name + " " + dispatch.name + " " + idle, line, ns });
+			}
+		}
+	}
+}
+
+//the same ROMs in a Chip8Batch. instructions counts every lane, so ips and ns
+//compare directly with the macro lines of a single machine
+template <unsigned int LANES>
+void RunBatch(uint64_t cycles, std::vector<BenchResult>& results)
+{
+	for (BenchRom const& rom : benchRoms)
+	{
+		std::unique_ptr<Chip8Batch<LANES>> batch(new Chip8Batch<LANES>(0));
+		batch->LoadROM(rom.code.data(), rom.code.size());
+
+		//every lane holds a different key, so the lanes of keywait split up
+		for (unsigned int lane = 0; lane < LANES; ++lane)
+		{
+			batch->SetKeypad(lane, (uint16_t)(1u << (lane % KEY_COUNT)));
+		}
+
+		uint64_t laneCycles = cycles / LANES + 1;
+		batch->Run(laneCycles / 100 + 1);
+
+		double seconds = 1e30;
+		for (unsigned int run = 0; run < 3; ++run)
+		{
+			auto startTime = std::chrono::steady_clock::now();
+			batch->Run(laneCycles);
+			auto endTime = std::chrono::steady_clock::now();
+
+			seconds = std::min(seconds, std::chrono::duration<double>(endTime - startTime).count());
+		}
+
+		uint64_t ran = laneCycles * LANES;
+		double ns = seconds * 1e9 / ran;
+
+		char line[256];
+		std::snprintf(line, sizeof(line), "batch rom=%s lanes=%u instructions=%llu seconds=%.3f ips=%.0f ns=%.3f",
+			rom.name, LANES, (unsigned long long)ran, seconds, seconds > 0.0 ? ran / seconds : 0.0, ns);
+		results.push_back(BenchResult{ std::string("batch ") + rom.name + " " + std::to_string(LANES), line, ns });
+	}
+}
+
+/***************************************************
+*  Baseline comparison                             *
+***************************************************/
+
+//reads the key and ns of every line a previous run wrote
+std::map<std::string, double> ReadBaseline(std::istream& in)
+{
+	std::map<std::string, double> baseline;
+	std::string line;
+
+	while (std::getline(in, line))
+	{
+		std::istringstream fields(line);
+		std::string kind;
+		std::string field;
+		std::string key;
+		double ns = -1.0;
+
+		fields >> kind;
+		key = kind;
+		while (fields >> field)
+		{
+			size_t equals = field.find('=');
+			if (equals == std::string::npos)
+			{
+				continue;
+			}
+
+			std::string name = field.substr(0, equals);
+			std::string value = field.substr(equals + 1);
+
+			if (name == "ns")
+			{
+				ns = std::stod(value);
+			}
+			else if (name == "name" || name == "rom" || name == "dispatch" || name == "idle" || name == "lanes")
+			{
+				key += " " + value;
+			}
+		}
+
+		if (ns >= 0.0)
+		{
+			baseline[key] = ns;
+		}
+	}
+
+	return baseline;
+}
+
+void Usage(char const* name)
+{
+	std::cerr << "Usage: " << name << " [options]\n"
+		<< "  --micro-only      only time the handlers\n"
+		<< "  --macro-only      only run the synthetic ROMs\n"
+		<< "  --iterations N    calls per handler (default 2000000)\n"
+		<< "  --cycles N        instructions per ROM and core (default 20000000)\n"
+		<< "  --dispatch D      core for the ROMs: table, switch, goto, flat, decoded,\n"
+		<< "                    fused, jit or all (default all)\n"
+		<< "  --out FILE        write the results to FILE instead of stdout\n"
+		<< "  --baseline FILE   compare with the results of an earlier run\n"
+		<< "  --tolerance P     with --baseline, fail when something got more than\n"
+		<< "                    P percent slower (default 10)\n";
+	std::exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[])
+{
+	bool micro = true;
+	bool macro = true;
+	uint64_t iterations = 2000000;
+	uint64_t cycles = 20000000;
+	double tolerance = 10.0;
+	std::string outFilename;
+	std::string baselineFilename;
+	std::vector<DispatchName> dispatches(std::begin(dispatchNames), std::end(dispatchNames));
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--micro-only")
+		{
+			macro = false;
+		}
+		else if (arg == "--macro-only")
+		{
+			micro = false;
+		}
+		else if (arg == "--iterations" && hasValue)
+		{
+			iterations = std::max<uint64_t>(1, std::stoull(argv[++i]));
+		}
+		else if (arg == "--cycles" && hasValue)
+		{
+			cycles = std::max<uint64_t>(1, std::stoull(argv[++i]));
+		}
+		else if (arg == "--dispatch" && hasValue)
+		{
+			std::string name = argv[++i];
+			dispatches.clear();
+
+			for (DispatchName const& dispatch : dispatchNames)
+			{
+				if (name == "all" || name == dispatch.name)
+				{
+					dispatches.push_back(dispatch);
+				}
+			}
+
+			if (dispatches.empty())
+			{
+				Usage(argv[0]);
+			}
+		}
+		else if (arg == "--out" && hasValue)
+		{
+			outFilename = argv[++i];
+		}
+		else if (arg == "--baseline" && hasValue)
+		{
+			baselineFilename = argv[++i];
+		}
+		else if (arg == "--tolerance" && hasValue)
+		{
+			tolerance = std::stod(argv[++i]);
+		}
+		else
+		{
+			Usage(argv[0]);
+		}
+	}
+
+	std::map<std::string, double> baseline;
+	if (!baselineFilename.empty())
+	{
+		std::ifstream baselineFile(baselineFilename);
+		if (!baselineFile.is_open())
+		{
+			std::cerr << "Could not open " << baselineFilename << "\n";
+			return EXIT_FAILURE;
+		}
+		baseline = ReadBaseline(baselineFile);
+	}
+
+	std::vector<BenchResult> results;
+	if (micro)
+	{
+		Chip8Bench::RunMicro(iterations, results);
+	}
+	if (macro)
+	{
+		RunMacro(cycles, dispatches, results);
+		RunFrames(cycles, dispatches, results);
+		RunBatch<8>(cycles, results);
+		RunBatch<16>(cycles, results);
+		RunBatch<32>(cycles, results);
+	}
+
+	std::ofstream outFile;
+	if (!outFilename.empty())
+	{
+		outFile.open(outFilename);
+		if (!outFile.is_open())
+		{
+			std::cerr << "Could not open " << outFilename << " for writing\n";
+			return EXIT_FAILURE;
+		}
+	}
+	std::ostream& out = outFile.is_open() ? outFile : std::cout;
+
+	size_t regressions = 0;
+	for (BenchResult const& result : results)
+	{
+		out << result.line << "\n";
+
+		auto old = baseline.find(result.key);
+		if (old == baseline.end() || old->second <= 0.0)
+		{
+			continue;
+		}
+
+		//the comparison goes to stderr, so the results stay a clean baseline for next time
+		double change = (result.ns - old->second) / old->second * 100.0;
+		bool slower = change > tolerance;
+		regressions += slower ? 1 : 0;
+
+		std::fprintf(stderr, "%-28s %9.3f ns -> %9.3f ns  %+6.1f%%%s\n", result.key.c_str(), old->second, result.ns,
+			change, slower ? "  SLOWER" : "");
+	}
+
+	if (!baseline.empty())
+	{
+		std::fprintf(stderr, "%zu results more than %.1f%% slower than the baseline\n", regressions, tolerance);
+	}
+
+	return regressions == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,476 @@
+//headless runner for the CHIP-8 core.
+//no window, no SDL. it loads a bunch of ROMs, runs every one of them
+//for a fixed number of cycles on a thread pool, and writes out a hash
+//of the framebuffer plus a register dump per ROM.
+//handy for regression runs over a whole ROM collection.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Chip8.hpp"
+#include "Movie.hpp"
+#include "RomLibrary.hpp"
+#include "StateHash.hpp"
+#include "ThreadPool.hpp"
+
+struct RomResult
+{
+	bool loaded{};
+	bool wrongRom{};	//the movie was recorded with a different ROM
+	uint64_t videoHash{};
+	uint64_t cycles{};
+	uint8_t registers[REGISTER_COUNT]{};
+	uint16_t index{};
+	uint16_t pc{};
+	uint8_t sp{};
+	uint8_t delay{};
+	uint8_t sound{};
+	bool looped{};	//with --loops: the machine came back to the state it was in at frame loopStart
+	uint32_t loopStart{};
+	uint32_t loopEnd{};
+};
+
+//64 bit FNV-1a. small, quick and good enough to tell two framebuffers apart
+uint64_t HashBytes(void const* data, size_t size)
+{
+	uint8_t const* bytes = static_cast<uint8_t const*>(data);
+	uint64_t hash = 0xCBF29CE484222325ull;
+
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ull;
+	}
+
+	return hash;
+}
+
+struct DispatchName
+{
+	Dispatch mode;
+	char const* name;
+};
+
+const DispatchName dispatchNames[] =
+{
+	{ Dispatch::Table, "table" },
+	{ Dispatch::Switch, "switch" },
+	{ Dispatch::Goto, "goto" },
+	{ Dispatch::Flat, "flat" },
+	{ Dispatch::Decoded, "decoded" },
+	{ Dispatch::Fused, "fused" },
+	{ Dispatch::Jit, "jit" },
+};
+
+//how a ROM gets run, the same for every ROM
+struct RunSettings
+{
+	uint64_t cycles;
+	uint64_t cyclesPerFrame;
+	uint64_t seed;
+	Movie const* movie;	//when set, the movie decides the keys, seed and length
+	Dispatch dispatch;
+	char const* profileDir;	//when set, write the profile of every ROM there (CHIP8_PROFILE builds)
+	bool loops;	//stop a ROM once it is back in a state it was in before (no keys are ever pressed)
+	bool idleSkip;	//fast-forward idle loops (see Chip8::Run)
+};
+
+#if CHIP8_PROFILE
+//DIR/<rom>.txt gets the hot spot report, DIR/<rom>.prof the flat profile
+void WriteProfile(std::string const& romFilename, char const* profileDir, Chip8& chip8)
+{
+	std::string name = romFilename.substr(romFilename.find_last_of("/\\") + 1);
+	std::string base = std::string(profileDir) + "/" + name;
+
+	FILE* report = std::fopen((base + ".txt").c_str(), "w");
+	if (report != nullptr)
+	{
+		chip8.GetProfile().Report(report, chip8.GetMemory());
+		std::fclose(report);
+	}
+
+	if (report == nullptr || !chip8.GetProfile().WriteFlatProfile((base + ".prof").c_str()))
+	{
+		std::fprintf(stderr, "Could not write the profile of %s to %s\n", romFilename.c_str(), profileDir);
+	}
+}
+#endif
+
+//rom is nullptr when it could not be loaded into the library
+void RunRom(std::string const& romFilename, RomImage const* rom, RunSettings const& settings, RomResult& result)
+{
+	if (rom == nullptr)
+	{
+		return;
+	}
+
+	//the library already holds the memory right after loading the ROM,
+	//the machine shares it until the ROM writes to memory
+	Chip8 chip8(settings.movie ? settings.movie->seed : settings.seed);
+	RomLibrary::Share(chip8, *rom);
+
+	chip8.SetDispatch(settings.dispatch);
+	chip8.SetIdleSkip(settings.idleSkip);
+
+	result.loaded = true;
+
+	if (settings.movie)
+	{
+		result.wrongRom = MovieRomHash(chip8) != settings.movie->romHash;
+		if (!result.wrongRom)
+		{
+			result.cycles = PlayMovie(chip8, *settings.movie);
+		}
+	}
+	else
+	{
+		//only allocated with --loops. nothing is pressed, so a state that comes
+		//back once comes back forever and the rest of the run would be the same loop
+		std::unique_ptr<TranspositionTable> seen;
+		if (settings.loops)
+		{
+			seen.reset(new TranspositionTable(std::min<uint64_t>(settings.cycles / settings.cyclesPerFrame + 1, 1u << 20u)));
+		}
+
+		//same timing as the window: the timers tick once per 60 Hz frame,
+		//which is every cyclesPerFrame instructions
+		for (uint32_t frame = 0; result.cycles < settings.cycles; ++frame)
+		{
+			uint64_t frameCycles = std::min(settings.cyclesPerFrame, settings.cycles - result.cycles);
+			result.cycles += chip8.Run(frameCycles);
+
+			if (frameCycles == settings.cyclesPerFrame)
+			{
+				chip8.TickTimers();
+			}
+
+			uint32_t start = frame;
+			if (seen && seen->Visit(chip8.StateHash(), start))
+			{
+				result.looped = true;
+				result.loopStart = start;
+				result.loopEnd = frame;
+				break;
+			}
+		}
+	}
+
+	result.videoHash = HashBytes(chip8.video, sizeof(chip8.video));
+	for (unsigned int i = 0; i < REGISTER_COUNT; ++i)
+	{
+		result.registers[i] = chip8.GetRegisters()[i];
+	}
+	result.index = chip8.GetIndex();
+	result.pc = chip8.GetPC();
+	result.sp = chip8.GetSP();
+	result.delay = chip8.GetDelay();
+	result.sound = chip8.GetSound();
+
+#if CHIP8_PROFILE
+	if (settings.profileDir != nullptr)
+	{
+		WriteProfile(romFilename, settings.profileDir, chip8);
+	}
+#else
+	(void)romFilename;	//only names the profile
+#endif
+}
+
+void WriteResult(std::ostream& out, std::string const& romFilename, RomResult const& result)
+{
+	if (!result.loaded)
+	{
+		out << romFilename << " error=load-failed\n";
+		return;
+	}
+
+	if (result.wrongRom)
+	{
+		out << romFilename << " error=movie-for-another-rom\n";
+		return;
+	}
+
+	char line[256];
+	int length = std::snprintf(line, sizeof(line), " hash=%016llx pc=0x%03X I=0x%03X sp=%u dt=%u st=%u V=",
+		(unsigned long long)result.videoHash, result.pc, result.index, result.sp, result.delay, result.sound);
+
+	for (unsigned int i = 0; i < REGISTER_COUNT; ++i)
+	{
+		length += std::snprintf(line + length, sizeof(line) - length, i == 0 ? "%02X" : ",%02X", result.registers[i]);
+	}
+
+	if (result.looped)
+	{
+		std::snprintf(line + length, sizeof(line) - length, " loop=%u..%u", result.loopStart, result.loopEnd);
+	}
+
+	out << romFilename << line << "\n";
+}
+
+void Usage(char const* name)
+{
+	std::cerr << "Usage: " << name << " [options] <ROM> [ROM...]\n"
+		<< "  --cycles N    run every ROM for N cycles (default 100000)\n"
+		<< "  --frames N    run every ROM for N frames instead\n"
+		<< "  --ipf N       cycles per 60 Hz frame, the delay and sound timers\n"
+		<< "                tick once per frame (default 10)\n"
+		<< "  --seed N      seed for the random numbers (default 0)\n"
+		<< "  --movie FILE  replay the movie FILE on every ROM instead, with its seed,\n"
+		<< "                keys and length, as fast as possible\n"
+		<< "  --threads N   worker threads (default: one per core)\n"
+		<< "  --dispatch D  interpreter core: table, switch, goto, flat, decoded,\n"
+		<< "                fused, jit or all (default table)\n"
+		<< "                'all' runs the ROMs once per core and prints the speed of each\n"
+		<< "  --list FILE   read more ROM paths from FILE, one per line\n"
+		<< "  --pack FILE   run every ROM of the ROM pack FILE as well\n"
+		<< "  --make-pack FILE  write all the ROMs given into the ROM pack FILE\n"
+		<< "                (each ROM once) before running them\n"
+		<< "  --out FILE    write the per ROM results to FILE instead of stdout\n"
+		<< "  --profile DIR write a hot spot report and a flat profile of every ROM\n"
+		<< "                to DIR (only in builds with CHIP8_PROFILE)\n"
+		<< "  --no-idle-skip  run idle loops instruction by instruction instead of\n"
+		<< "                fast-forwarding them (same results, for timing the cores)\n"
+		<< "  --loops       stop a ROM once it comes back to a state it was in at the\n"
+		<< "                end of an earlier frame, and print loop=FIRST..AGAIN\n";
+	std::exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[])
+{
+	uint64_t cycles = 100000;
+	uint64_t frames = 0;
+	uint64_t cyclesPerFrame = 10;
+	unsigned int threads = 0;
+	uint64_t seed = 0;
+	Movie movie;
+	bool hasMovie = false;
+	std::string outFilename;
+	char const* profileDir = nullptr;
+	bool loops = false;
+	bool idleSkip = true;
+	std::string packFilename;
+	std::vector<std::string> roms;
+	//the ROMs are read (and checked) once, while the arguments are read
+	RomLibrary library;
+	std::vector<RomImage const*> romImages;
+	std::vector<DispatchName> dispatches = { dispatchNames[0] };
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+
+		if (arg == "--cycles" && hasValue)
+		{
+			cycles = std::stoull(argv[++i]);
+		}
+		else if (arg == "--frames" && hasValue)
+		{
+			frames = std::stoull(argv[++i]);
+		}
+		else if (arg == "--ipf" && hasValue)
+		{
+			cyclesPerFrame = std::stoull(argv[++i]);
+			if (cyclesPerFrame == 0)
+			{
+				Usage(argv[0]);
+			}
+		}
+		else if (arg == "--seed" && hasValue)
+		{
+			seed = std::stoull(argv[++i]);
+		}
+		else if (arg == "--movie" && hasValue)
+		{
+			if (!movie.Load(argv[++i]))
+			{
+				std::cerr << "Could not read the movie " << argv[i] << "\n";
+				return EXIT_FAILURE;
+			}
+			hasMovie = true;
+		}
+		else if (arg == "--threads" && hasValue)
+		{
+			threads = std::stoul(argv[++i]);
+		}
+		else if (arg == "--dispatch" && hasValue)
+		{
+			std::string name = argv[++i];
+			dispatches.clear();
+
+			for (DispatchName const& dispatch : dispatchNames)
+			{
+				if (name == "all" || name == dispatch.name)
+				{
+					dispatches.push_back(dispatch);
+				}
+			}
+
+			if (dispatches.empty())
+			{
+				Usage(argv[0]);
+			}
+		}
+		else if (arg == "--out" && hasValue)
+		{
+			outFilename = argv[++i];
+		}
+		else if (arg == "--profile" && hasValue)
+		{
+			profileDir = argv[++i];
+			if (!CHIP8_PROFILE)
+			{
+				std::cerr << "--profile needs a build with -DCHIP8_PROFILE=1\n";
+				return EXIT_FAILURE;
+			}
+		}
+		else if (arg == "--no-idle-skip")
+		{
+			idleSkip = false;
+		}
+		else if (arg == "--loops")
+		{
+			loops = true;
+		}
+		else if (arg == "--list" && hasValue)
+		{
+			std::ifstream list(argv[++i]);
+			if (!list.is_open())
+			{
+				std::cerr << "Could not open ROM list " << argv[i] << "\n";
+				return EXIT_FAILURE;
+			}
+
+			std::string line;
+			while (std::getline(list, line))
+			{
+				if (!line.empty() && line.back() == '\r')
+				{
+					line.pop_back();
+				}
+
+				if (!line.empty())
+				{
+					roms.push_back(line);
+					romImages.push_back(library.AddFile(line.c_str()));
+				}
+			}
+		}
+		else if (arg == "--pack" && hasValue)
+		{
+			std::vector<RomImage const*> found;
+			if (!library.AddPack(argv[++i], found))
+			{
+				std::cerr << "Could not read the ROM pack " << argv[i] << "\n";
+				return EXIT_FAILURE;
+			}
+
+			for (RomImage const* rom : found)
+			{
+				roms.push_back(rom->name);
+				romImages.push_back(rom);
+			}
+		}
+		else if (arg == "--make-pack" && hasValue)
+		{
+			packFilename = argv[++i];
+		}
+		else if (arg.rfind("--", 0) == 0)
+		{
+			Usage(argv[0]);
+		}
+		else
+		{
+			roms.push_back(arg);
+			romImages.push_back(library.AddFile(arg.c_str()));
+		}
+	}
+
+	if (roms.empty())
+	{
+		Usage(argv[0]);
+	}
+
+	if (!packFilename.empty() && !library.WritePack(packFilename.c_str()))
+	{
+		std::cerr << "Could not write the ROM pack " << packFilename << "\n";
+		return EXIT_FAILURE;
+	}
+
+	if (frames > 0)
+	{
+		cycles = frames * cyclesPerFrame;
+	}
+
+	std::vector<RomResult> results(roms.size());
+	ThreadPool pool(threads);
+
+	//with more than one core selected the results of the first one get written,
+	//the others are only there to be timed
+	for (size_t d = 0; d < dispatches.size(); ++d)
+	{
+		std::vector<RomResult> dispatchResults(roms.size());
+
+		auto startTime = std::chrono::steady_clock::now();
+
+		pool.ParallelFor(roms.size(), [&](size_t i)
+		{
+			//the profile of the first core is enough, a profiling build runs them all the same way
+			RunSettings settings{ cycles, cyclesPerFrame, seed, hasMovie ? &movie : nullptr, dispatches[d].mode,
+				d == 0 ? profileDir : nullptr, loops, idleSkip };
+			RunRom(roms[i], romImages[i], settings, dispatchResults[i]);
+		});
+
+		auto endTime = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+		uint64_t totalCycles = 0;
+		for (RomResult const& result : dispatchResults)
+		{
+			totalCycles += result.cycles;
+		}
+
+		std::fprintf(stderr, "%-6s %zu ROMs on %u threads: %llu instructions in %.3f s, %.1f M instructions/s\n",
+			dispatches[d].name, roms.size(), pool.Size(), (unsigned long long)totalCycles, seconds,
+			seconds > 0.0 ? totalCycles / seconds / 1e6 : 0.0);
+
+		if (d == 0)
+		{
+			results.swap(dispatchResults);
+		}
+	}
+
+	//write the results in the same order the ROMs were given,
+	//so two runs can simply be diffed
+	std::ofstream outFile;
+	if (!outFilename.empty())
+	{
+		outFile.open(outFilename);
+		if (!outFile.is_open())
+		{
+			std::cerr << "Could not open " << outFilename << " for writing\n";
+			return EXIT_FAILURE;
+		}
+	}
+	std::ostream& out = outFile.is_open() ? outFile : std::cout;
+
+	size_t failed = 0;
+	for (size_t i = 0; i < roms.size(); ++i)
+	{
+		WriteResult(out, roms[i], results[i]);
+		failed += results[i].loaded && !results[i].wrongRom ? 0 : 1;
+	}
+
+	if (failed > 0)
+	{
+		std::fprintf(stderr, "%zu of %zu ROMs failed\n", failed, roms.size());
+	}
+
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
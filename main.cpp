@@ -5,56 +5,380 @@
 *												   *
 ***************************************************/
 
+#include <atomic>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include "string"
+#if defined(_WIN32)
 #include "windows.h"
+#endif
 #include "Chip8.hpp"
+#include "Movie.hpp"
 #include "Platform.hpp"
+#include "Rewind.hpp"
+#include "Savestate.hpp"
+#include "Scheduler.hpp"
+#include "Telemetry.hpp"
 
 void HideConsole()
 {
+#if defined(_WIN32)
 	ShowWindow(GetConsoleWindow(), SW_HIDE);
+#endif
 }
 
+void Usage(char const* name)
+{
+	std::cerr << "Usage: " << name << " <Scale> <CyclesPerFrame> <ROM> [options]\n"
+		<< "  --vsync         wait for the display refresh when presenting\n"
+		<< "  --frameskip N   only present every N+1th frame (default 0)\n"
+		<< "  --turbo N       start in turbo mode, presenting every Nth frame (default 10)\n"
+		<< "  --state FILE    resume from FILE if it exists, save to it when quitting\n"
+		<< "  --seed N        seed for the random numbers (default: the clock)\n"
+		<< "  --record FILE   record the keys into the movie FILE\n"
+		<< "  --play FILE     play the movie FILE back (uses its seed and CyclesPerFrame)\n"
+		<< "  --profile FILE  print a hot spot report and write a flat profile to FILE\n"
+		<< "                  when quitting or when F1 is pressed (CHIP8_PROFILE builds)\n"
+		<< "  --telemetry FILE  write frame timings and instructions/s to FILE once a second\n"
+		<< "Tab switches turbo mode on and off while running, hold Backspace to rewind\n";
+	std::exit(EXIT_FAILURE);
+}
+
+#if CHIP8_PROFILE
+void DumpProfile(Chip8& chip8, char const* profileFilename)
+{
+	chip8.GetProfile().Report(stdout, chip8.GetMemory());
+	std::fflush(stdout);
+
+	if (!chip8.GetProfile().WriteFlatProfile(profileFilename))
+	{
+		std::cerr << "Could not write the profile to " << profileFilename << "\n";
+	}
+}
+#endif
+
 int main(int argc, char* argv[])
 {
 	//hide the console window
 	HideConsole();
-	if (argc != 4)
+	if (argc < 4)
 	{
-		std::cerr << "Usage: " << argv[0] << " <Scale> <Delay> <ROM>\n";
-		std::exit(EXIT_FAILURE);
+		Usage(argv[0]);
 	}
 
 	int videoScale = std::stoi(argv[1]);
-	int cycleDelay = std::stoi(argv[2]);
+	//instructions per 60 Hz frame. 10 is about 600 instructions a second,
+	//which is what most games were written for
+	int cyclesPerFrame = std::stoi(argv[2]);
 	const char* romFilename = argv[3];
 
-	Platform platform("CHIP-8 Emulator", VIDEO_WIDTH * videoScale, VIDEO_HEIGHT * videoScale, VIDEO_WIDTH, VIDEO_HEIGHT);
+	bool vsync = false;
+	bool startTurbo = false;
+	unsigned int frameSkip = 0;
+	unsigned int turboPresentEvery = 10;
+	const char* stateFilename = nullptr;
+	const char* recordFilename = nullptr;
+	const char* playFilename = nullptr;
+	const char* telemetryFilename = nullptr;
+#if CHIP8_PROFILE
+	const char* profileFilename = nullptr;
+#endif
+	uint64_t seed = (uint64_t)std::chrono::system_clock::now().time_since_epoch().count();
+
+	for (int i = 4; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+
+		if (arg == "--vsync")
+		{
+			vsync = true;
+		}
+		else if (arg == "--frameskip" && i + 1 < argc)
+		{
+			frameSkip = std::stoul(argv[++i]);
+		}
+		else if (arg == "--turbo" && i + 1 < argc)
+		{
+			startTurbo = true;
+			turboPresentEvery = std::stoul(argv[++i]);
+			turboPresentEvery = turboPresentEvery > 0 ? turboPresentEvery : 1;
+		}
+		else if (arg == "--state" && i + 1 < argc)
+		{
+			stateFilename = argv[++i];
+		}
+		else if (arg == "--seed" && i + 1 < argc)
+		{
+			seed = std::stoull(argv[++i]);
+		}
+		else if (arg == "--record" && i + 1 < argc)
+		{
+			recordFilename = argv[++i];
+		}
+		else if (arg == "--play" && i + 1 < argc)
+		{
+			playFilename = argv[++i];
+		}
+		else if (arg == "--telemetry" && i + 1 < argc)
+		{
+			telemetryFilename = argv[++i];
+		}
+#if CHIP8_PROFILE
+		else if (arg == "--profile" && i + 1 < argc)
+		{
+			profileFilename = argv[++i];
+		}
+#endif
+		else
+		{
+			Usage(argv[0]);
+		}
+	}
+
+	//a movie starts at power on, so it doesnt mix with savestates
+	//(or with rewinding, which is switched off while one is running)
+	bool movieRunning = recordFilename != nullptr || playFilename != nullptr;
+	if (movieRunning && (stateFilename != nullptr || (recordFilename != nullptr && playFilename != nullptr)))
+	{
+		Usage(argv[0]);
+	}
+
+	Movie movie;
+	if (playFilename != nullptr)
+	{
+		if (!movie.Load(playFilename))
+		{
+			std::cerr << "Could not read the movie " << playFilename << "\n";
+			std::exit(EXIT_FAILURE);
+		}
+
+		seed = movie.seed;
+		cyclesPerFrame = (int)movie.cyclesPerFrame;
+	}
+
+	Platform platform("CHIP-8 Emulator", VIDEO_WIDTH * videoScale, VIDEO_HEIGHT * videoScale, VIDEO_WIDTH, VIDEO_HEIGHT, vsync);
+	platform.SetTurbo(startTurbo);
 
-	Chip8 chip8;
+	Chip8 chip8(seed);
 	chip8.LoadROM(romFilename);
 
-	int videoPitch = sizeof(chip8.video[0]) * VIDEO_WIDTH;
+	if (playFilename != nullptr && MovieRomHash(chip8) != movie.romHash)
+	{
+		std::cerr << playFilename << " was recorded with a different ROM\n";
+		std::exit(EXIT_FAILURE);
+	}
 
-	auto lastCycleTime = std::chrono::high_resolution_clock::now();
-	bool quit = false;
+	if (recordFilename != nullptr)
+	{
+		movie.seed = seed;
+		movie.cyclesPerFrame = cyclesPerFrame > 0 ? cyclesPerFrame : 1;
+		movie.romHash = MovieRomHash(chip8);
+	}
+	MoviePlayer player(movie);
 
-	while (!quit)
+	//pick up where the last session left off
+	Chip8State state;
+	if (stateFilename != nullptr && LoadStateFile(stateFilename, state))
 	{
-		quit = platform.ProcessInput(chip8.keypad);
+		chip8.LoadState(state);
+	}
 
-		auto currentTime = std::chrono::high_resolution_clock::now();
-		float dt = std::chrono::duration<float, std::chrono::milliseconds::period>(currentTime - lastCycleTime).count();
+	//the emulator keeps 1 bit per pixel, SDL wants RGBA
+	uint32_t pixels[VIDEO_WIDTH * VIDEO_HEIGHT]{};
+	int videoPitch = sizeof(pixels[0]) * VIDEO_WIDTH;
+	//the screen that was presented last, so a machine sitting in an idle loop
+	//(a menu waiting for a key) doesnt get the same picture uploaded 60 times a second
+	uint64_t shownVideo[VIDEO_HEIGHT]{};
+	bool shown = false;
+	uint16_t shownKeys = 0;
 
-		if (dt > cycleDelay)
+	FrameScheduler scheduler(60);
+
+	FrameTelemetry telemetry;
+	if (telemetryFilename != nullptr)
+	{
+		platform.SetTelemetry(&telemetry);
+	}
+	auto frameStart = FrameTelemetry::Clock::now();
+	auto telemetryWritten = frameStart;
+
+	//4 MB of history is several minutes at 60 frames a second
+	RewindBuffer rewind(4 * 1024 * 1024);
+	chip8.SaveState(state);
+	rewind.Push(state);
+
+	std::atomic<bool> quit{};
+	bool wasTurbo = false;
+	uint64_t frame = 0;
+	uint32_t emulatedFrame = 0;
+
+	//for the speed shown in the title while in turbo mode
+	uint64_t speedFrames = 0;
+	auto speedStart = std::chrono::steady_clock::now();
+
+	//the emulator runs on a thread of its own. the main thread keeps the window:
+	//it handles the events and presents the frames the emulator hands over
+	std::thread emulator([&]()
+	{
+		while (!quit.load(std::memory_order_relaxed))
 		{
-			lastCycleTime = currentTime;
+			auto inputStart = FrameTelemetry::Clock::now();
+			if (telemetryFilename != nullptr)
+			{
+				telemetry.Record(FrameStage::Frame, inputStart - frameStart);
+				frameStart = inputStart;
+			}
+
+#if CHIP8_PROFILE
+			if (platform.TakeDumpRequest() && profileFilename != nullptr)
+			{
+				DumpProfile(chip8, profileFilename);
+			}
+#endif
+
+			bool turbo = platform.Turbo();
+			if (turbo != wasTurbo)
+			{
+				//start timing from now, so leaving turbo doesnt try to catch up
+				//and entering it starts a fresh measurement
+				scheduler.Reset();
+				speedFrames = 0;
+				speedStart = std::chrono::steady_clock::now();
+				platform.SetTitle("CHIP-8 Emulator");
+				wasTurbo = turbo;
+			}
+
+			//the keys are read as late as they can be, right before the frame runs.
+			//frame + 1 is the number this frame gets presented with
+			uint16_t keys = platform.ReadKeys(frame + 1);
+			bool keysChanged = keys != shownKeys;
+			shownKeys = keys;
+			auto emulateStart = FrameTelemetry::Clock::now();
+
+			if (platform.Rewinding() && !movieRunning)
+			{
+				//one frame back per frame. the keys that are held right now stay held
+				if (rewind.StepBack(state))
+				{
+					chip8.LoadState(state);
+				}
+				SetKeypad(chip8.keypad, keys);
+			}
+			else
+			{
+				SetKeypad(chip8.keypad, keys);
 
-			chip8.Cycle();
+				//the keys only count at the start of a frame, that is all a movie has to know
+				if (recordFilename != nullptr)
+				{
+					movie.Record(emulatedFrame, KeypadMask(chip8.keypad));
+				}
+				else if (playFilename != nullptr && !player.Finished(emulatedFrame))
+				{
+					SetKeypad(chip8.keypad, player.KeysFor(emulatedFrame));
+				}
 
-			platform.Update(chip8.video, videoPitch);
+				//one frame: a batch of instructions, then the 60 Hz timers
+				telemetry.AddInstructions(chip8.Run(cyclesPerFrame > 0 ? cyclesPerFrame : 1));
+				chip8.TickTimers();
+				++emulatedFrame;
+
+				chip8.SaveState(state);
+				rewind.Push(state);
+			}
+			++frame;
+			++speedFrames;
+
+			if (telemetryFilename != nullptr)
+			{
+				auto emulateEnd = FrameTelemetry::Clock::now();
+				telemetry.Record(FrameStage::Input, emulateStart - inputStart);
+				telemetry.Record(FrameStage::Emulate, emulateEnd - emulateStart);
+
+				//after the stages of this frame are recorded, so the file I/O
+				//doesnt show up in them
+				if (emulateEnd - telemetryWritten >= std::chrono::seconds(1))
+				{
+					if (!telemetry.Write(telemetryFilename))
+					{
+						std::cerr << "Could not write the telemetry to " << telemetryFilename << "\n";
+					}
+					telemetryWritten = emulateEnd;
+				}
+			}
+
+			//presenting costs far more than emulating a frame, so only do it for the frames
+			//someone will see. in turbo mode that is every Nth one, otherwise every frameSkip+1th
+			unsigned int presentEvery = turbo ? turboPresentEvery : frameSkip + 1;
+			bool present = frame % presentEvery == 0;
+			//an idle machine with the same screen isnt shown again, unless the frame
+			//saw a key change (the input to photon time is measured to that present)
+			if (present && shown && !keysChanged && chip8.GetIdle() != IdleState::Running &&
+				memcmp(shownVideo, chip8.video, sizeof(shownVideo)) == 0)
+			{
+				present = false;
+			}
+
+			if (present)
+			{
+				chip8.ExpandVideo(pixels);
+				platform.Update(pixels, videoPitch, frame);
+				memcpy(shownVideo, chip8.video, sizeof(shownVideo));
+				shown = true;
+			}
+
+			if (turbo)
+			{
+				//as fast as we can, show how much faster than real time that is once a second
+				double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - speedStart).count();
+				if (seconds >= 1.0)
+				{
+					char title[64];
+					std::snprintf(title, sizeof(title), "CHIP-8 Emulator - turbo %.1fx", speedFrames / 60.0 / seconds);
+					platform.SetTitle(title);
+
+					speedFrames = 0;
+					speedStart = std::chrono::steady_clock::now();
+				}
+			}
+			else
+			{
+				//sleep until the next frame instead of spinning. presenting happens on
+				//the main thread (waiting for vsync there, if asked to), so the
+				//scheduler is what keeps the pace
+				scheduler.WaitForNextFrame();
+			}
+		}
+	});
+
+	while (!platform.ProcessEvents())
+	{
+	}
+	quit.store(true, std::memory_order_relaxed);
+	emulator.join();
+
+#if CHIP8_PROFILE
+	if (profileFilename != nullptr)
+	{
+		DumpProfile(chip8, profileFilename);
+	}
+#endif
+
+	if (recordFilename != nullptr && !movie.Save(recordFilename))
+	{
+		std::cerr << "Could not save the movie to " << recordFilename << "\n";
+	}
+
+	if (stateFilename != nullptr)
+	{
+		chip8.SaveState(state);
+		if (!SaveStateFile(stateFilename, state))
+		{
+			std::cerr << "Could not save the state to " << stateFilename << "\n";
 		}
 	}
 
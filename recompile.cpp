@@ -0,0 +1,341 @@
+//static recompiler. reads a ROM, follows the control flow from 0x200 and writes
+//a C++ file with one function per reachable basic block (see Recompiled.hpp).
+//compile the result together with Recompiled.cpp, Chip8.cpp and Jit.cpp to get
+//a binary for just that ROM:
+//  recompile pong.ch8 pong.cpp
+//  g++ -std=c++17 -O2 pong.cpp Recompiled.cpp Chip8.cpp Jit.cpp -o pong
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+#include "Chip8.hpp"
+
+//longer blocks dont get any faster, they only make Run() fall back to single
+//instructions for longer at the end of a cycle budget
+const unsigned int MAX_BLOCK_LENGTH = 256;
+
+struct BlockInfo
+{
+	uint16_t length{};
+	std::string body;
+};
+
+std::string Hex(unsigned int value, int digits)
+{
+	char text[16];
+	std::snprintf(text, sizeof(text), "0x%0*X", digits, value);
+	return text;
+}
+
+/*
+Translate one instruction into C++
+
+Parameters:
+address = where the instruction is
+op = the opcode
+successors = addresses this instruction can continue at, if they are known ahead of time
+
+Returns:
+true if the instruction ends the block
+*/
+bool Translate(uint16_t address, uint16_t op, std::string& out, std::vector<uint16_t>& successors)
+{
+	std::string x = Hex((op & 0x0F00u) >> 8u, 1);
+	std::string y = Hex((op & 0x00F0u) >> 4u, 1);
+	std::string kk = Hex(op & 0x00FFu, 2);
+	std::string nnn = Hex(op & 0x0FFFu, 3);
+	std::string next = Hex(address + 2u, 3);
+	std::string skip = Hex(address + 4u, 3);
+	std::string code;
+	bool terminator = false;
+
+	//instructions that look at pc get it set first, then use the normal handler
+	std::string handler = "m.pc = " + next + "; m.Op(" + Hex(op, 4) + ");";
+
+	switch (op >> 12u)
+	{
+		case 0x0:
+			switch (op & 0x000Fu)
+			{
+				case 0x0:
+					code = "m.Op(" + Hex(op, 4) + ");";
+					break;
+				case 0xE:
+					code = "m.sp--; m.pc = m.stack[m.sp];";
+					terminator = true;
+					break;
+			}
+			break;
+		case 0x1:
+			code = "m.pc = " + nnn + ";";
+			successors.push_back(op & 0x0FFFu);
+			terminator = true;
+			break;
+		case 0x2:
+			code = "m.stack[m.sp] = " + next + "; m.sp++; m.pc = " + nnn + ";";
+			successors.push_back(op & 0x0FFFu);
+			successors.push_back(address + 2u);
+			terminator = true;
+			break;
+		case 0x3:
+			code = "m.pc = m.V[" + x + "] == " + kk + " ? " + skip + " : " + next + ";";
+			terminator = true;
+			break;
+		case 0x4:
+			code = "m.pc = m.V[" + x + "] != " + kk + " ? " + skip + " : " + next + ";";
+			terminator = true;
+			break;
+		case 0x5:
+			code = "m.pc = m.V[" + x + "] == m.V[" + y + "] ? " + skip + " : " + next + ";";
+			terminator = true;
+			break;
+		case 0x6:
+			code = "m.V[" + x + "] = " + kk + ";";
+			break;
+		case 0x7:
+			code = "m.V[" + x + "] += " + kk + ";";
+			break;
+		case 0x8:
+			//same statements in the same order as the OP_8XY* handlers
+			switch (op & 0x000Fu)
+			{
+				case 0x0: code = "m.V[" + x + "] = m.V[" + y + "];"; break;
+				case 0x1: code = "m.V[" + x + "] |= m.V[" + y + "];"; break;
+				case 0x2: code = "m.V[" + x + "] &= m.V[" + y + "];"; break;
+				case 0x3: code = "m.V[" + x + "] ^= m.V[" + y + "];"; break;
+				case 0x4: code = "{ uint16_t sum = m.V[" + x + "] + m.V[" + y + "]; m.V[0xF] = sum > 255u; m.V[" + x + "] = sum & 0xFFu; }"; break;
+				case 0x5: code = "m.V[0xF] = m.V[" + x + "] > m.V[" + y + "]; m.V[" + x + "] -= m.V[" + y + "];"; break;
+				case 0x6: code = "m.V[0xF] = m.V[" + x + "] & 0x01u; m.V[" + x + "] = m.V[" + x + "] >> 1u;"; break;
+				case 0x7: code = "m.V[0xF] = m.V[" + y + "] > m.V[" + x + "]; m.V[" + x + "] = m.V[" + y + "] - m.V[" + x + "];"; break;
+				case 0xE: code = "m.V[0xF] = (m.V[" + x + "] & 0x80u) >> 7u; m.V[" + x + "] = m.V[" + x + "] << 1u;"; break;
+			}
+			break;
+		case 0x9:
+			code = "m.pc = m.V[" + x + "] != m.V[" + y + "] ? " + skip + " : " + next + ";";
+			terminator = true;
+			break;
+		case 0xA:
+			code = "m.I = " + nnn + ";";
+			break;
+		case 0xB:
+			//the target depends on V0, Run() finds the block at runtime (or interprets)
+			code = "m.pc = m.V[0x0] + " + nnn + ";";
+			terminator = true;
+			break;
+		case 0xC:
+			code = "m.Op(" + Hex(op, 4) + ");";
+			break;
+		case 0xD:
+			code = handler;
+			terminator = true;
+			break;
+		case 0xE:
+			code = handler;
+			terminator = true;
+			break;
+		case 0xF:
+			switch (op & 0x00FFu)
+			{
+				case 0x07: code = "m.V[" + x + "] = m.delay;"; break;
+				case 0x15: code = "m.delay = m.V[" + x + "];"; break;
+				case 0x18: code = "m.sound = m.V[" + x + "];"; break;
+				case 0x1E: code = "m.I += m.V[" + x + "];"; break;
+				case 0x29:
+				case 0x65:
+					code = "m.Op(" + Hex(op, 4) + ");";
+					break;
+				case 0x0A:
+					//waits by going back to itself, so it needs a block of its own
+					code = handler;
+					successors.push_back(address);
+					terminator = true;
+					break;
+				case 0x33:
+				case 0x55:
+					//could write over translated code, Run() checks before the next block
+					code = handler;
+					terminator = true;
+					break;
+			}
+			break;
+	}
+
+	//skips and the instructions that end a block for other reasons carry on at the next one
+	switch (op >> 12u)
+	{
+		case 0x3:
+		case 0x4:
+		case 0x5:
+		case 0x9:
+		case 0xE:
+			successors.push_back(address + 2u);
+			successors.push_back(address + 4u);
+			break;
+		case 0xD:
+		case 0xF:
+			if (terminator)
+			{
+				successors.push_back(address + 2u);
+			}
+			break;
+	}
+
+	if (code.empty())
+	{
+		code = "/* does nothing */";
+	}
+
+	out += "\t" + code + "\t// " + Hex(address, 3) + ": " + Hex(op, 4).substr(2) + "\n";
+	return terminator;
+}
+
+int main(int argc, char* argv[])
+{
+	bool withMain = true;
+	std::vector<char const*> files;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::string(argv[i]) == "--no-main")
+		{
+			withMain = false;
+		}
+		else
+		{
+			files.push_back(argv[i]);
+		}
+	}
+
+	if (files.size() != 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " <ROM> <output.cpp> [--no-main]\n"
+			<< "  --no-main   leave out main(), the file then only defines chip8Program\n";
+		return EXIT_FAILURE;
+	}
+
+	std::ifstream file(files[0], std::ios::binary);
+	if (!file.is_open())
+	{
+		std::cerr << "Could not open " << files[0] << "\n";
+		return EXIT_FAILURE;
+	}
+	std::vector<uint8_t> rom((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	//an empty ROM has nothing to recompile (and rom[] would be an array of size 0)
+	if (rom.empty())
+	{
+		std::cerr << files[0] << " is empty\n";
+		return EXIT_FAILURE;
+	}
+
+	//load it exactly like the emulator does and work on the resulting memory
+	Chip8 chip8;
+	if (!chip8.LoadROM(rom.data(), rom.size()))
+	{
+		std::cerr << files[0] << " does not fit in memory\n";
+		return EXIT_FAILURE;
+	}
+	uint8_t const* memory = chip8.GetMemory();
+	unsigned int romEnd = START_ADDRESS + (unsigned int)rom.size();
+
+	//walk every block we can reach, starting at 0x200
+	std::map<uint16_t, BlockInfo> blocks;
+	std::vector<uint16_t> work = { (uint16_t)START_ADDRESS };
+
+	while (!work.empty())
+	{
+		uint16_t start = work.back();
+		work.pop_back();
+
+		//only code that is in the ROM itself is translated, anything else
+		//(jumps into the font or into memory the ROM fills at runtime) gets interpreted
+		if (start < START_ADDRESS || start + 1u >= romEnd || blocks.count(start))
+		{
+			continue;
+		}
+
+		BlockInfo& block = blocks[start];
+		std::vector<uint16_t> successors;
+		uint16_t address = start;
+		bool terminated = false;
+
+		while (!terminated && block.length < MAX_BLOCK_LENGTH && address + 1u < romEnd)
+		{
+			uint16_t op = (memory[address] << 8u) | memory[address + 1];
+			terminated = Translate(address, op, block.body, successors);
+			block.length++;
+			address += 2;
+		}
+
+		//fell off the end of the block without a jump, keep going after it
+		if (!terminated)
+		{
+			block.body += "\tm.pc = " + Hex(address, 3) + ";\n";
+			successors.push_back(address);
+		}
+
+		work.insert(work.end(), successors.begin(), successors.end());
+	}
+
+	std::ofstream out(files[1]);
+	if (!out.is_open())
+	{
+		std::cerr << "Could not open " << files[1] << " for writing\n";
+		return EXIT_FAILURE;
+	}
+
+	std::string name = files[0];
+	size_t slash = name.find_last_of("/\\");
+	if (slash != std::string::npos)
+	{
+		name = name.substr(slash + 1);
+	}
+
+	out << "//generated by recompile from " << name << ", do not edit\n"
+		<< "//" << blocks.size() << " blocks\n\n"
+		<< "#include \"Recompiled.hpp\"\n\n"
+		<< "namespace\n{\n\n"
+		<< "const uint8_t rom[] =\n{";
+
+	for (size_t i = 0; i < rom.size(); ++i)
+	{
+		out << (i % 16 == 0 ? "\n\t" : " ") << Hex(rom[i], 2) << ",";
+	}
+	out << "\n};\n\n";
+
+	for (auto const& block : blocks)
+	{
+		out << "void Block_" << Hex(block.first, 3).substr(2) << "(Chip8Recompiled::Machine& m)\n{\n"
+			<< block.second.body << "}\n\n";
+	}
+
+	out << "const Chip8Recompiled::Block blocks[] =\n{\n";
+	for (auto const& block : blocks)
+	{
+		out << "\t{ " << Hex(block.first, 3) << ", " << block.second.length << ", &Block_" << Hex(block.first, 3).substr(2) << " },\n";
+	}
+	//an array cant have 0 entries. a ROM without a single block to translate
+	//gets one placeholder that the count leaves out
+	if (blocks.empty())
+	{
+		out << "\t{ 0, 0, nullptr },\n";
+	}
+	out << "};\n\n"
+		<< "}\n\n"
+		<< "extern const Chip8Recompiled::Program chip8Program =\n"
+		<< "{\n\t\"" << name << "\", rom, sizeof(rom), blocks, " << blocks.size() << "\n};\n";
+
+	if (withMain)
+	{
+		out << "\nint main(int argc, char* argv[])\n{\n"
+			<< "\treturn Chip8Recompiled::Main(chip8Program, argc, argv);\n}\n";
+	}
+
+	std::cerr << name << ": " << blocks.size() << " blocks written to " << files[1] << "\n";
+	return EXIT_SUCCESS;
+}
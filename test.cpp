@@ -0,0 +1,637 @@
+//tests for the CHIP-8 core. every check runs the same ROMs on two machines that
+//should agree and compares the whole state (Chip8State) after every 60 Hz frame:
+//  cores      every Dispatch with the idle loop skip on and off, against Dispatch::Table with it off
+//  batch      the lanes of Chip8Batch<8/16/32> against single machines with the same seed, stream and keys
+//  statehash  StateHash against ComputeStateHash, every frame and after LoadState and Fork
+//built with -DCHIP8_TEST_RECOMPILED and a ROM translated by chip8-recompile --no-main:
+//  recompiled Chip8Recompiled::Run against the interpreter (what --interpret runs)
+//
+//the ROMs are a few small hand written ones (one per kind of instruction) and
+//random ones from a fixed seed. all of them stay inside what the cores define
+//the same way: no stack overflow, no key numbers past F, no I past memory.
+//prints one line per check, and the first differences it found. exits with 1 when anything differed
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Batch.hpp"
+#include "Chip8.hpp"
+#include "Movie.hpp"
+#if CHIP8_TEST_RECOMPILED
+#include "Recompiled.hpp"
+
+//the table chip8-recompile --no-main wrote
+extern const Chip8Recompiled::Program chip8Program;
+#endif
+
+/***************************************************
+*  Test ROMs                                       *
+***************************************************/
+
+struct TestRom
+{
+	std::string name;
+	std::vector<uint8_t> code;
+};
+
+const TestRom handRoms[] =
+{
+	//every 8XYN, the register skips and the adds that carry into VF
+	{ "alu", {
+		0x60, 0x01,	//200: V0 = 1
+		0x61, 0x03,	//202: V1 = 3
+		0x80, 0x14,	//204: V0 += V1
+		0x80, 0x15,	//206: V0 -= V1
+		0x80, 0x17,	//208: V0 = V1 - V0
+		0x80, 0x11,	//20A: V0 |= V1
+		0x80, 0x12,	//20C: V0 &= V1
+		0x80, 0x13,	//20E: V0 ^= V1
+		0x81, 0x06,	//210: V1 >>= 1
+		0x81, 0x1E,	//212: V1 <<= 1
+		0x71, 0x37,	//214: V1 += 37
+		0x82, 0x04,	//216: V2 += V0
+		0x51, 0x20,	//218: skip if V1 == V2
+		0x91, 0x20,	//21A: skip if V1 != V2
+		0x32, 0x33,	//21C: skip if V2 == 33
+		0x42, 0x33,	//21E: skip if V2 != 33
+		0x72, 0x01,	//220: V2 += 1
+		0x12, 0x04,	//222: jump 204
+	} },
+	//font digits drawn all over the screen (and off its edges), cleared on a collision
+	{ "sprites", {
+		0x60, 0x00,	//200: V0 = 0
+		0x61, 0x00,	//202: V1 = 0
+		0x62, 0x00,	//204: V2 = 0
+		0xF2, 0x29,	//206: I = font V2
+		0xD0, 0x15,	//208: draw 5 rows at V0, V1
+		0x70, 0x07,	//20A: V0 += 7
+		0x71, 0x03,	//20C: V1 += 3
+		0x72, 0x01,	//20E: V2 += 1
+		0x42, 0x10,	//210: skip if V2 != 16
+		0x62, 0x00,	//212: V2 = 0
+		0x3F, 0x01,	//214: skip if VF == 1
+		0x12, 0x06,	//216: jump 206
+		0x00, 0xE0,	//218: clear the screen
+		0x12, 0x06,	//21A: jump 206
+	} },
+	//BCD, register stores and loads and I += Vx
+	{ "memory", {
+		0x63, 0x01,	//200: V3 = 1
+		0xA3, 0x00,	//202: I = 300
+		0xF3, 0x1E,	//204: I += V3
+		0xF0, 0x33,	//206: BCD of V0 at I
+		0xF2, 0x65,	//208: V0..V2 = [I]
+		0xF4, 0x55,	//20A: [I] = V0..V4
+		0x75, 0x07,	//20C: V5 += 7
+		0x80, 0x50,	//20E: V0 = V5
+		0xF5, 0x29,	//210: I = font V5
+		0xF1, 0x65,	//212: V0, V1 = [I]
+		0x12, 0x02,	//214: jump 202
+	} },
+	//code that writes over itself: 212 is CLS, turned into VB += 2 and back
+	//again every round, and every third round it is jumped to as CLS
+	{ "smc", {
+		0x6A, 0x00,	//200: VA = 0
+		0x7A, 0x01,	//202: VA += 1
+		0x3A, 0x05,	//204: skip if VA == 5
+		0x12, 0x02,	//206: jump 202
+		0x60, 0x7B,	//208: V0 = 7B
+		0x61, 0x02,	//20A: V1 = 02
+		0xA2, 0x12,	//20C: I = 212
+		0xF1, 0x55,	//20E: [212] = 7B02
+		0x6A, 0x00,	//210: VA = 0
+		0x00, 0xE0,	//212: clear the screen, or VB += 2
+		0x60, 0x00,	//214: V0 = 00
+		0x61, 0xE0,	//216: V1 = E0
+		0xF1, 0x55,	//218: [212] = 00E0
+		0x7C, 0x01,	//21A: VC += 1
+		0x3C, 0x03,	//21C: skip if VC == 3
+		0x12, 0x02,	//21E: jump 202
+		0x6C, 0x00,	//220: VC = 0
+		0x12, 0x12,	//222: jump 212
+	} },
+	//nested calls and a BNNN jump table
+	{ "calls", {
+		0x60, 0x00,	//200: V0 = 0
+		0x22, 0x10,	//202: call 210
+		0xB2, 0x30,	//204: jump 230 + V0
+		0x00, 0x00,	//206:
+		0x00, 0x00,	//208:
+		0x00, 0x00,	//20A:
+		0x00, 0x00,	//20C:
+		0x00, 0x00,	//20E:
+		0x71, 0x01,	//210: V1 += 1
+		0x22, 0x18,	//212: call 218
+		0x00, 0xEE,	//214: return
+		0x00, 0x00,	//216:
+		0x72, 0x01,	//218: V2 += 1
+		0x00, 0xEE,	//21A: return
+		0x00, 0x00,	//21C:
+		0x00, 0x00,	//21E:
+		0x00, 0x00,	//220:
+		0x00, 0x00,	//222:
+		0x00, 0x00,	//224:
+		0x00, 0x00,	//226:
+		0x00, 0x00,	//228:
+		0x00, 0x00,	//22A:
+		0x00, 0x00,	//22C:
+		0x00, 0x00,	//22E:
+		0x12, 0x38,	//230: jump 238
+		0x12, 0x3C,	//232: jump 23C
+		0x12, 0x40,	//234: jump 240
+		0x00, 0x00,	//236:
+		0x60, 0x02,	//238: V0 = 2
+		0x12, 0x02,	//23A: jump 202
+		0x60, 0x04,	//23C: V0 = 4
+		0x12, 0x02,	//23E: jump 202
+		0x60, 0x00,	//240: V0 = 0
+		0x12, 0x02,	//242: jump 202
+	} },
+	//random keys checked with EX9E/EXA1, and every 32 rounds a wait for a key that gets drawn
+	{ "keys", {
+		0xC0, 0x0F,	//200: V0 = random & F
+		0xE0, 0x9E,	//202: skip if key V0 is down
+		0x12, 0x08,	//204: jump 208
+		0x71, 0x01,	//206: V1 += 1
+		0xE0, 0xA1,	//208: skip if key V0 is up
+		0x72, 0x01,	//20A: V2 += 1
+		0x73, 0x01,	//20C: V3 += 1
+		0x33, 0x20,	//20E: skip if V3 == 20
+		0x12, 0x00,	//210: jump 200
+		0xF4, 0x0A,	//212: V4 = wait for a key
+		0x63, 0x00,	//214: V3 = 0
+		0x80, 0x40,	//216: V0 = V4
+		0xF0, 0x29,	//218: I = font V0
+		0xD5, 0x65,	//21A: draw 5 rows at V5, V6
+		0x12, 0x00,	//21C: jump 200
+	} },
+	//waits for the delay timer (an idle loop) and draws a digit every time it ran out
+	{ "timers", {
+		0x60, 0x30,	//200: V0 = 30
+		0xF0, 0x15,	//202: delay = V0
+		0xF0, 0x18,	//204: sound = V0
+		0xF1, 0x07,	//206: V1 = delay
+		0x31, 0x00,	//208: skip if V1 == 0
+		0x12, 0x06,	//20A: jump 206
+		0x72, 0x01,	//20C: V2 += 1
+		0xF2, 0x29,	//20E: I = font V2
+		0xD3, 0x45,	//210: draw 5 rows at V3, V4
+		0x73, 0x05,	//212: V3 += 5
+		0x60, 0x08,	//214: V0 = 8
+		0x12, 0x02,	//216: jump 202
+	} },
+	//random digits at random places, cleared at random
+	{ "random", {
+		0xC0, 0x3F,	//200: V0 = random & 3F
+		0xC1, 0x1F,	//202: V1 = random & 1F
+		0xC2, 0x0F,	//204: V2 = random & F
+		0xF2, 0x29,	//206: I = font V2
+		0xD0, 0x15,	//208: draw 5 rows at V0, V1
+		0xC3, 0x01,	//20A: V3 = random & 1
+		0x33, 0x00,	//20C: skip if V3 == 0
+		0x00, 0xE0,	//20E: clear the screen
+		0x12, 0x00,	//210: jump 200
+	} },
+};
+
+const unsigned int RANDOM_ROMS = 40;
+const unsigned int RANDOM_ROM_INSTRUCTIONS = 64;
+
+//splitmix64, only for making up ROMs and keys
+uint64_t Mix(uint64_t x)
+{
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30u)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27u)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31u);
+}
+
+//random instructions, bent into ones every core has to run the same way:
+//jumps stay inside the ROM, I stays far enough from the end of memory for FX33/FX55/DXYN,
+//and calls, returns, BNNN, EX and FX1E (the ones that can leave the stack,
+//the keypad or memory) become loads. two jumps to 200 at the end catch the last skip
+TestRom RandomRom(unsigned int number)
+{
+	static const uint8_t fxOps[] = { 0x07, 0x0A, 0x15, 0x18, 0x29, 0x33, 0x55, 0x65 };
+
+	TestRom rom{ "random" + std::to_string(number), {} };
+	uint64_t state = 0xC8C8C8C8ull + number;
+
+	for (unsigned int i = 0; i < RANDOM_ROM_INSTRUCTIONS; ++i)
+	{
+		uint64_t r = Mix(state++);
+		uint16_t opcode = r & 0xFFFFu;
+		uint16_t x = opcode & 0x0F00u;
+
+		switch (opcode >> 12u)
+		{
+			case 0x0:
+				opcode = 0x00E0u;
+				break;
+			case 0x1:
+				opcode = 0x1000u | (START_ADDRESS + 2u * ((r >> 16u) % (RANDOM_ROM_INSTRUCTIONS + 2u)));
+				break;
+			case 0xA:
+				opcode = 0xA300u + (r >> 16u) % 0xB00u;
+				break;
+			case 0xF:
+				opcode = 0xF000u | x | fxOps[(r >> 16u) % sizeof(fxOps)];
+				break;
+			case 0x2:
+			case 0xB:
+			case 0xE:
+				opcode = 0x6000u | (opcode & 0x0FFFu);
+				break;
+		}
+
+		rom.code.push_back(opcode >> 8u);
+		rom.code.push_back(opcode & 0xFFu);
+	}
+
+	for (int i = 0; i < 2; ++i)
+	{
+		rom.code.push_back(0x12);
+		rom.code.push_back(0x00);
+	}
+
+	return rom;
+}
+
+std::vector<TestRom> TestRoms()
+{
+	std::vector<TestRom> roms(std::begin(handRoms), std::end(handRoms));
+
+	for (unsigned int i = 0; i < RANDOM_ROMS; ++i)
+	{
+		roms.push_back(RandomRom(i));
+	}
+
+	return roms;
+}
+
+/***************************************************
+*  Checks                                          *
+***************************************************/
+
+const unsigned int FRAMES = 300;
+const uint64_t ipfs[] = { 1, 7, 10, 64 };
+
+const struct
+{
+	char const* name;
+	Dispatch mode;
+} dispatches[] =
+{
+	{ "table", Dispatch::Table },
+	{ "switch", Dispatch::Switch },
+	{ "goto", Dispatch::Goto },
+	{ "flat", Dispatch::Flat },
+	{ "decoded", Dispatch::Decoded },
+	{ "fused", Dispatch::Fused },
+	{ "jit", Dispatch::Jit },
+};
+
+unsigned int failures = 0;
+
+void Fail(std::string const& what)
+{
+	//the first few are enough to go on, the count says the rest
+	if (failures < 20)
+	{
+		std::fprintf(stderr, "FAIL %s\n", what.c_str());
+	}
+
+	++failures;
+}
+
+//the keys of a lane in a frame: a new mask every 7 frames, and none at all
+//for a third of the time so FX0A has to wait
+uint16_t Keys(unsigned int frame, unsigned int lane)
+{
+	uint64_t r = Mix((uint64_t(frame / 7u) << 8u) | lane);
+	return (r % 3u == 0) ? 0 : ((r >> 8u) & 0xFFFFu);
+}
+
+//the first part of two states that differs, nullptr when they are the same
+char const* Differs(Chip8State const& a, Chip8State const& b)
+{
+	if (std::memcmp(a.memory, b.memory, sizeof(a.memory)) != 0) return "memory";
+	if (std::memcmp(a.registers, b.registers, sizeof(a.registers)) != 0) return "registers";
+	if (a.index != b.index) return "index";
+	if (a.pc != b.pc) return "pc";
+	if (a.sp != b.sp) return "sp";
+	if (std::memcmp(a.stack, b.stack, sizeof(a.stack)) != 0) return "stack";
+	if (a.delay != b.delay || a.sound != b.sound) return "timers";
+	if (std::memcmp(a.keypad, b.keypad, sizeof(a.keypad)) != 0) return "keypad";
+	if (std::memcmp(a.video, b.video, sizeof(a.video)) != 0) return "video";
+	if (a.randomKey != b.randomKey || a.randomCounter != b.randomCounter) return "random";
+	return nullptr;
+}
+
+bool Compare(Chip8 const& expected, Chip8 const& actual, std::string const& what, unsigned int frame)
+{
+	Chip8State a{};
+	Chip8State b{};
+	expected.SaveState(a);
+	actual.SaveState(b);
+
+	if (char const* part = Differs(a, b))
+	{
+		Fail(what + " frame " + std::to_string(frame) + ": " + part + " differs");
+		return false;
+	}
+
+	return true;
+}
+
+bool CheckHash(Chip8 const& chip, std::string const& what, unsigned int frame)
+{
+	if (chip.StateHash() != chip.ComputeStateHash())
+	{
+		Fail(what + " frame " + std::to_string(frame) + ": StateHash differs from ComputeStateHash");
+		return false;
+	}
+
+	return true;
+}
+
+void Frame(Chip8& chip, uint64_t ipf, uint16_t keys)
+{
+	SetKeypad(chip.keypad, keys);
+	chip.Run(ipf);
+	chip.TickTimers();
+}
+
+//every Dispatch, idle skip on and off, against Table with it off
+unsigned int CheckCores(std::vector<TestRom> const& roms)
+{
+	unsigned int runs = 0;
+
+	for (TestRom const& rom : roms)
+	{
+		for (uint64_t ipf : ipfs)
+		{
+			Chip8 expected(1);
+			expected.SetIdleSkip(false);
+			expected.LoadROM(rom.code.data(), rom.code.size());
+
+			std::vector<std::unique_ptr<Chip8>> machines;
+			std::vector<std::string> names;
+			for (auto const& dispatch : dispatches)
+			{
+				for (bool idle : { false, true })
+				{
+					machines.emplace_back(new Chip8(1));
+					machines.back()->SetDispatch(dispatch.mode);
+					machines.back()->SetIdleSkip(idle);
+					machines.back()->LoadROM(rom.code.data(), rom.code.size());
+					names.push_back(rom.name + " " + dispatch.name + " ipf " + std::to_string(ipf) + (idle ? " idle on" : " idle off"));
+				}
+			}
+
+			std::vector<bool> failed(machines.size());
+			for (unsigned int frame = 0; frame < FRAMES; ++frame)
+			{
+				Frame(expected, ipf, Keys(frame, 0));
+
+				for (size_t i = 0; i < machines.size(); ++i)
+				{
+					Frame(*machines[i], ipf, Keys(frame, 0));
+					if (!failed[i])
+					{
+						failed[i] = !Compare(expected, *machines[i], names[i], frame);
+					}
+				}
+			}
+
+			runs += machines.size();
+		}
+	}
+
+	return runs;
+}
+
+//lane i of a batch against Chip8(seed, i), each with its own keys
+template <unsigned int LANES>
+unsigned int CheckBatch(std::vector<TestRom> const& roms)
+{
+	const uint64_t seed = 7;
+	unsigned int runs = 0;
+
+	for (TestRom const& rom : roms)
+	{
+		for (uint64_t ipf : ipfs)
+		{
+			std::unique_ptr<Chip8Batch<LANES>> batch(new Chip8Batch<LANES>(seed));
+			batch->LoadROM(rom.code.data(), rom.code.size());
+
+			std::vector<std::unique_ptr<Chip8>> lanes;
+			for (unsigned int lane = 0; lane < LANES; ++lane)
+			{
+				lanes.emplace_back(new Chip8(seed, lane));
+				lanes.back()->SetDispatch(Dispatch::Table);
+				lanes.back()->SetIdleSkip(false);
+				lanes.back()->LoadROM(rom.code.data(), rom.code.size());
+			}
+
+			std::string what = rom.name + " batch " + std::to_string(LANES) + " ipf " + std::to_string(ipf) + " lane ";
+			bool failed = false;
+			for (unsigned int frame = 0; frame < FRAMES && !failed; ++frame)
+			{
+				for (unsigned int lane = 0; lane < LANES; ++lane)
+				{
+					batch->SetKeypad(lane, Keys(frame, lane));
+					Frame(*lanes[lane], ipf, Keys(frame, lane));
+				}
+				batch->Run(ipf);
+				batch->TickTimers();
+
+				for (unsigned int lane = 0; lane < LANES && !failed; ++lane)
+				{
+					Chip8State a{};
+					Chip8State b{};
+					lanes[lane]->SaveState(a);
+					batch->SaveState(lane, b);
+
+					if (char const* part = Differs(a, b))
+					{
+						Fail(what + std::to_string(lane) + " frame " + std::to_string(frame) + ": " + part + " differs");
+						failed = true;
+					}
+				}
+			}
+
+			++runs;
+		}
+	}
+
+	return runs;
+}
+
+//the incremental hash on every core, after LoadState (back to an earlier
+//frame) and on forks, which start out sharing the memory of their parent
+unsigned int CheckStateHash(std::vector<TestRom> const& roms)
+{
+	unsigned int runs = 0;
+
+	for (TestRom const& rom : roms)
+	{
+		for (auto const& dispatch : dispatches)
+		{
+			std::string what = rom.name + " " + dispatch.name;
+			Chip8 chip(3);
+			chip.SetDispatch(dispatch.mode);
+			chip.LoadROM(rom.code.data(), rom.code.size());
+
+			Chip8State saved{};
+			uint64_t savedHash = chip.StateHash();
+			chip.SaveState(saved);
+
+			bool failed = !CheckHash(chip, what, 0);
+			for (unsigned int frame = 0; frame < FRAMES && !failed; ++frame)
+			{
+				Frame(chip, 10, Keys(frame, 0));
+				failed = !CheckHash(chip, what, frame);
+
+				if (!failed && frame % 50 == 49)
+				{
+					//back to the last save, which has to give the hash it had then
+					Chip8State now{};
+					chip.SaveState(now);
+					chip.LoadState(saved);
+					if (chip.StateHash() != savedHash || !CheckHash(chip, what + " LoadState", frame))
+					{
+						Fail(what + " LoadState frame " + std::to_string(frame) + ": the hash is not the one it was saved with");
+						failed = true;
+					}
+					chip.LoadState(now);
+					failed = failed || !CheckHash(chip, what + " LoadState", frame);
+
+					savedHash = chip.StateHash();
+					chip.SaveState(saved);
+				}
+
+				if (!failed && frame % 60 == 59)
+				{
+					//a fork runs exactly like a machine that loaded its state
+					std::unique_ptr<Chip8> fork = chip.Fork(5);
+					Chip8State forked{};
+					fork->SaveState(forked);
+					Chip8 copy(3);
+					copy.SetDispatch(dispatch.mode);
+					copy.LoadState(forked);
+
+					failed = !CheckHash(*fork, what + " Fork", frame);
+					for (unsigned int step = 0; step < 20 && !failed; ++step)
+					{
+						Frame(*fork, 10, Keys(frame + step, 1));
+						Frame(copy, 10, Keys(frame + step, 1));
+						failed = !CheckHash(*fork, what + " Fork", frame + step) || !Compare(copy, *fork, what + " Fork", frame + step);
+					}
+					if (!failed && fork->StateHash() != copy.StateHash())
+					{
+						Fail(what + " Fork frame " + std::to_string(frame) + ": the same state hashes differently");
+						failed = true;
+					}
+				}
+			}
+
+			++runs;
+		}
+	}
+
+	return runs;
+}
+
+#if CHIP8_TEST_RECOMPILED
+//the translated ROM against the interpreter, for a few seeds, frame lengths and keys
+unsigned int CheckRecompiled()
+{
+	unsigned int runs = 0;
+
+	for (uint64_t seed : { 0, 1, 42 })
+	{
+		for (uint64_t ipf : ipfs)
+		{
+			Chip8Recompiled recompiled(chip8Program);
+			Chip8 chip(seed);
+			Chip8 expected(seed);
+			expected.SetIdleSkip(false);
+			recompiled.Load(chip);
+			recompiled.Load(expected);
+
+			std::string what = std::string(chip8Program.name) + " recompiled seed " + std::to_string(seed) + " ipf " + std::to_string(ipf);
+			uint64_t translated = 0;
+			for (unsigned int frame = 0; frame < FRAMES; ++frame)
+			{
+				SetKeypad(chip.keypad, Keys(frame, seed));
+				translated += recompiled.Run(chip, ipf);
+				chip.TickTimers();
+				Frame(expected, ipf, Keys(frame, seed));
+
+				if (!Compare(expected, chip, what, frame))
+				{
+					break;
+				}
+			}
+
+			//a translation that never runs does not test anything
+			if (translated == 0)
+			{
+				Fail(what + ": no translated blocks ran");
+			}
+
+			++runs;
+		}
+	}
+
+	return runs;
+}
+#endif
+
+int main(int argc, char* argv[])
+{
+	std::vector<TestRom> roms = TestRoms();
+
+	//--write-rom NAME FILE saves one of the test ROMs, to feed it to chip8-recompile
+	if (argc == 4 && std::strcmp(argv[1], "--write-rom") == 0)
+	{
+		for (TestRom const& rom : roms)
+		{
+			if (rom.name == argv[2])
+			{
+				std::ofstream file(argv[3], std::ios::binary);
+				file.write(reinterpret_cast<char const*>(rom.code.data()), rom.code.size());
+				return file ? EXIT_SUCCESS : EXIT_FAILURE;
+			}
+		}
+
+		std::fprintf(stderr, "no test ROM called %s\n", argv[2]);
+		return EXIT_FAILURE;
+	}
+	else if (argc != 1)
+	{
+		std::fprintf(stderr, "Usage: %s [--write-rom NAME FILE]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::printf("cores %u runs\n", CheckCores(roms));
+	std::printf("batch %u runs\n", CheckBatch<8>(roms) + CheckBatch<16>(roms) + CheckBatch<32>(roms));
+	std::printf("statehash %u runs\n", CheckStateHash(roms));
+#if CHIP8_TEST_RECOMPILED
+	std::printf("recompiled %u runs\n", CheckRecompiled());
+#endif
+
+	if (failures != 0)
+	{
+		std::printf("%u failures\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	std::printf("ok\n");
+	return EXIT_SUCCESS;
+}